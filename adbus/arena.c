@@ -0,0 +1,176 @@
+/* vim: ts=4 sw=4 sts=4 et
+ *
+ * Copyright (c) 2009 James R. McKaskill
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * ----------------------------------------------------------------------------
+ */
+
+#define ADBUS_LIBRARY
+#include "misc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef va_copy
+#   ifdef _MSC_VER
+#       define va_copy(d,s) d = s
+#   elif defined __GNUC__
+#       define va_copy(d,s) __builtin_va_copy(d,s)
+#   endif
+#endif
+
+/* --------------------------------------------------------------------------
+ * The arena has a single main block that allocations are bumped out of.
+ * Anything that doesn't fit (or everything when the arena is disabled) is
+ * allocated as a separate block. When the outermost scope ends the separate
+ * blocks are freed and the main block is grown to fit them, so that once
+ * the arena has seen the largest message no more mallocs are needed.
+ */
+
+struct adbusI_ArenaBlock
+{
+    struct adbusI_ArenaBlock*   next;
+    size_t                      size;
+};
+
+#define BLOCK_HEADER ADBUSI_ALIGN(sizeof(struct adbusI_ArenaBlock), 8)
+
+static void FreeBlocks(adbusI_Arena* a)
+{
+    struct adbusI_ArenaBlock* b = a->blocks;
+    while (b) {
+        struct adbusI_ArenaBlock* next = b->next;
+        free(b);
+        b = next;
+    }
+    a->blocks = NULL;
+    a->blocksSize = 0;
+}
+
+// ----------------------------------------------------------------------------
+
+void adbusI_arena_enable(adbusI_Arena* a, adbus_Bool enable)
+{
+    assert(a->depth == 0);
+    a->enabled = enable;
+    if (!enable) {
+        free(a->data);
+        a->data = NULL;
+        a->size = 0;
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+void adbusI_arena_begin(adbusI_Arena* a)
+{ a->depth++; }
+
+// ----------------------------------------------------------------------------
+
+void adbusI_arena_end(adbusI_Arena* a)
+{
+    assert(a->depth > 0);
+    if (--a->depth > 0)
+        return;
+
+    if (a->enabled && a->blocks) {
+        size_t total = a->used + a->blocksSize;
+        if (total > a->size) {
+            size_t size = ADBUSI_ALIGN(total, 1024);
+            if (size < 2 * a->size) {
+                size = 2 * a->size;
+            }
+
+            free(a->data);
+            a->data = (char*) malloc(size);
+            a->size = size;
+            a->mallocs++;
+        }
+    }
+
+    FreeBlocks(a);
+    a->used = 0;
+}
+
+// ----------------------------------------------------------------------------
+
+void* adbusI_arena_alloc(adbusI_Arena* a, size_t size)
+{
+    size = ADBUSI_ALIGN(size, 8);
+
+    if (a->enabled && a->size - a->used >= size) {
+        char* ret = a->data + a->used;
+        a->used += size;
+        return ret;
+    }
+
+    struct adbusI_ArenaBlock* b = (struct adbusI_ArenaBlock*) malloc(BLOCK_HEADER + size);
+    b->next = a->blocks;
+    b->size = size;
+    a->blocks = b;
+    a->blocksSize += size;
+    a->mallocs++;
+    return (char*) b + BLOCK_HEADER;
+}
+
+// ----------------------------------------------------------------------------
+
+// Returns a null terminated formatted string
+char* adbusI_arena_vprintf(adbusI_Arena* a, size_t* size, const char* format, va_list ap)
+{
+    va_list aq;
+    va_copy(aq, ap);
+#ifdef _MSC_VER
+    int n = _vscprintf(format, aq);
+#else
+    int n = vsnprintf(NULL, 0, format, aq);
+#endif
+    va_end(aq);
+
+    if (n < 0) {
+        n = 0;
+    }
+
+    char* str = (char*) adbusI_arena_alloc(a, n + 1);
+#ifdef _MSC_VER
+    _vsnprintf(str, n + 1, format, ap);
+#else
+    vsnprintf(str, n + 1, format, ap);
+#endif
+    str[n] = '\0';
+
+    if (size) {
+        *size = n;
+    }
+    return str;
+}
+
+// ----------------------------------------------------------------------------
+
+void adbusI_arena_free(adbusI_Arena* a)
+{
+    FreeBlocks(a);
+    free(a->data);
+    a->data = NULL;
+    a->size = 0;
+    a->used = 0;
+}
+
@@ -139,6 +139,32 @@
  *  In general this should be defaulted using adbus_conn_getproxy().
  */
 
+/** \var adbus_Bind::fallback
+ *  Whether the bind also handles all of the paths below adbus_Bind::path.
+ *
+ *  This allows a large number of objects to be exported with a single bind
+ *  instead of one bind per object. Method calls and property accesses on a
+ *  path with no binds of its own are handled by the fallback binds on the
+ *  longest prefix of the path that has any. The callbacks can get the actual
+ *  path from adbus_CbData::msg.
+ *
+ *  The children of the sub-paths are listed in introspection data via
+ *  adbus_Bind::children.
+ */
+
+/** \var adbus_Bind::children
+ *  Callback to list the children of a path for introspection.
+ *
+ *  This is called with adbus_Bind::cuser2, the path being introspected (the
+ *  bound path or for fallback binds any path below it), and a buffer. It
+ *  should append the name of each child (ie "bar" for "/foo/bar" when
+ *  introspecting "/foo") to the buffer with adbus_buf_append() including the
+ *  null terminator. Children registered with their own binds are listed
+ *  automatically.
+ *
+ *  \note This is always called on the connection thread.
+ */
+
 
 
 // ----------------------------------------------------------------------------
@@ -175,9 +201,18 @@ static adbus_ConnBind* DoBind(struct ObjectPath* path, const adbus_Bind* bind)
     b->ruser[1]         = bind->ruser[1];
     b->relproxy         = bind->relproxy;
     b->relpuser         = bind->relpuser;
+    b->fallback         = bind->fallback;
+    b->children         = bind->children;
+
+    if (b->fallback) {
+        path->fallbacks++;
+        path->connection->fallbacks++;
+    }
 
     dh_val(&path->interfaces, bi) = b;
     dh_key(&path->interfaces, bi) = b->interface->name;
+    ds_clear(&path->introspection);
+    path->methodsDirty = 1;
 
     dil_insert_after(Bind, &path->connection->binds, b, &b->fl);
 
@@ -186,15 +221,15 @@ static adbus_ConnBind* DoBind(struct ObjectPath* path, const adbus_Bind* bind)
 
 // ----------------------------------------------------------------------------
 
-void adbusI_freeObjectPath(struct ObjectPath* o)
+static void FreeObject(struct ObjectPath* o)
 {
-    // Disconnect from connection
-    if (o->connection) {
-        d_Hash(ObjectPath)* h = &o->connection->paths;
-        dh_Iter oi = dh_get(ObjectPath, h, o->path);
-        if (oi != dh_end(h)) {
-            dh_del(ObjectPath, h, oi);
-        }
+    // Free the children first. We don't need to unlink them as we are about
+    // to free the lookup table and list.
+    struct ObjectPath* child = o->childList.next;
+    while (child) {
+        struct ObjectPath* next = child->siblings.next;
+        FreeObject(child);
+        child = next;
     }
 
     // Disconnect from binds
@@ -207,12 +242,33 @@ void adbusI_freeObjectPath(struct ObjectPath* o)
         }
     }
 
+    dh_free(ObjectPath, &o->children);
     dh_free(Bind, &o->interfaces);
-    dv_free(ObjectPath, &o->children);
-    free((char*) o->path.str);
+    ds_free(&o->introspection);
+    dh_free(MethodIndex, &o->methods);
+    dv_free(MethodEntry, &o->methodEntries);
+    free(o->methodNames);
     free(o);
 }
 
+void adbusI_freeObjectPath(struct ObjectPath* o)
+{
+    // Disconnect from the parent or connection
+    struct ObjectPath* parent = o->parent;
+    if (parent) {
+        dh_Iter oi = dh_get(ObjectPath, &parent->children, o->name);
+        if (oi != dh_end(&parent->children)) {
+            dh_del(ObjectPath, &parent->children, oi);
+        }
+        dl_remove(ObjectPath, o, &o->siblings);
+        ds_clear(&parent->introspection);
+    } else if (o->connection && o->connection->root == o) {
+        o->connection->root = NULL;
+    }
+
+    FreeObject(o);
+}
+
 // ----------------------------------------------------------------------------
 
 static void CheckRemoveObject(struct ObjectPath* o)
@@ -220,7 +276,7 @@ static void CheckRemoveObject(struct ObjectPath* o)
     // We have 2 built in interfaces (introspectable and properties)
     // If these are the only two left and we have no children then we need
     // to prune this object
-    if (dh_size(&o->interfaces) > 2 || dv_size(&o->children) > 0)
+    if (dh_size(&o->interfaces) > 2 || dh_size(&o->children) > 0)
         return;
 
     // Remove the built in interfaces.
@@ -234,20 +290,13 @@ static void CheckRemoveObject(struct ObjectPath* o)
         }
     }
 
-    // Remove it from its parent
+    // Free the object and then check if the parent is now empty
     struct ObjectPath* parent = o->parent;
+    adbusI_freeObjectPath(o);
+
     if (parent) {
-        for (size_t i = 0; i < dv_size(&parent->children); ++i) {
-            if (dv_a(&parent->children, i) == o) {
-                dv_remove(ObjectPath, &parent->children, i, 1);
-                break;
-            }
-        }
-        CheckRemoveObject(o->parent);
+        CheckRemoveObject(parent);
     }
-
-    // Free the object
-    adbusI_freeObjectPath(o);
 }
 
 // ----------------------------------------------------------------------------
@@ -260,6 +309,12 @@ void adbusI_freeBind(adbus_ConnBind* bind)
         if (bi != dh_end(&o->interfaces)) {
             dh_del(Bind, &o->interfaces, bi);
         }
+        if (bind->fallback) {
+            o->fallbacks--;
+            o->connection->fallbacks--;
+        }
+        ds_clear(&o->introspection);
+        o->methodsDirty = 1;
         CheckRemoveObject(o);
     }
 
@@ -286,24 +341,35 @@ void adbusI_freeBind(adbus_ConnBind* bind)
 
 // ----------------------------------------------------------------------------
 
-static struct ObjectPath* GetObject(
+static struct ObjectPath* NewObject(
         adbus_Connection*       c,
-        dh_strsz_t              path)
+        struct ObjectPath*      parent,
+        dh_strsz_t              name,
+        size_t                  pathSize)
 {
-    int added;
-    assert(adbusI_isValidObjectPath(path.str, path.sz));
-    dh_Iter ki = dh_put(ObjectPath, &c->paths, path, &added);
-    if (!added) {
-        return dh_val(&c->paths, ki);
-    }
+    // The name is allocated along with the object
+    struct ObjectPath* o = (struct ObjectPath*) calloc(1, sizeof(struct ObjectPath) + name.sz + 1);
+    char* namestr = (char*) (o + 1);
+    memcpy(namestr, name.str, name.sz);
+    namestr[name.sz] = '\0';
+
+    o->connection   = c;
+    o->parent       = parent;
+    o->name.str     = namestr;
+    o->name.sz      = name.sz;
+    o->pathSize     = pathSize;
 
-    struct ObjectPath* o = NEW(struct ObjectPath);
-    o->connection        = c;
-    o->path.str          = adbusI_strndup(path.str, path.sz);
-    o->path.sz           = path.sz;
-
-    dh_key(&c->paths, ki) = o->path;
-    dh_val(&c->paths, ki) = o;
+    if (parent) {
+        int added;
+        dh_Iter ci = dh_put(ObjectPath, &parent->children, o->name, &added);
+        assert(added);
+        dh_key(&parent->children, ci) = o->name;
+        dh_val(&parent->children, ci) = o;
+        dl_insert_after(ObjectPath, &parent->childList, o, &o->siblings);
+        ds_clear(&parent->introspection);
+    } else {
+        c->root = o;
+    }
 
     // Bind the builtin interfaces
 
@@ -318,14 +384,79 @@ static struct ObjectPath* GetObject(
     b.interface = c->properties;
     DoBind(o, &b);
 
-    // Setup the parent-child links
-    dh_strsz_t parent;
-    adbusI_parentPath(path, &parent);
-    if (parent.str) {
-        o->parent = GetObject(c, parent);
+    return o;
+}
+
+// ----------------------------------------------------------------------------
+
+static struct ObjectPath* GetObject(
+        adbus_Connection*       c,
+        dh_strsz_t              path)
+{
+    assert(adbusI_isValidObjectPath(path.str, path.sz));
+
+    dh_strsz_t rootname = {"", 0};
+    struct ObjectPath* o = c->root;
+    if (!o) {
+        o = NewObject(c, NULL, rootname, 1);
+    }
+
+    // Walk down the tree one segment at a time, adding objects as needed
+    const char* end = path.str + path.sz;
+    const char* seg = path.str + 1;
+    while (seg < end) {
+        const char* segend = seg;
+        while (segend < end && *segend != '/') {
+            segend++;
+        }
+
+        dh_strsz_t name = {seg, segend - seg};
+        dh_Iter ci = dh_get(ObjectPath, &o->children, name);
+        if (ci != dh_end(&o->children)) {
+            o = dh_val(&o->children, ci);
+        } else {
+            o = NewObject(c, o, name, segend - path.str);
+        }
+
+        seg = segend + 1;
+    }
+
+    return o;
+}
+
+// ----------------------------------------------------------------------------
+
+struct ObjectPath* adbusI_lookupPath(
+        adbus_Connection*       c,
+        const char*             path,
+        size_t                  pathSize,
+        struct ObjectPath**     fallback)
+{
+    if (fallback) {
+        *fallback = NULL;
+    }
+
+    if (pathSize == 0 || path[0] != '/')
+        return NULL;
+
+    struct ObjectPath* o = c->root;
+    const char* end = path + pathSize;
+    const char* seg = path + 1;
+    while (o && seg < end) {
+        if (fallback && o->fallbacks > 0) {
+            *fallback = o;
+        }
+
+        const char* segend = seg;
+        while (segend < end && *segend != '/') {
+            segend++;
+        }
+
+        dh_strsz_t name = {seg, segend - seg};
+        dh_Iter ci = dh_get(ObjectPath, &o->children, name);
+        o = (ci != dh_end(&o->children)) ? dh_val(&o->children, ci) : NULL;
 
-        struct ObjectPath** pchild = dv_push(ObjectPath, &o->parent->children, 1);
-        *pchild = o;
+        seg = segend + 1;
     }
 
     return o;
@@ -359,50 +490,240 @@ void adbus_conn_unbind(
 
 // ----------------------------------------------------------------------------
 
-int adbusI_dispatchBind(adbus_CbData* d)
+static void BuildMethodTable(struct ObjectPath* o)
 {
-    // should have been checked by parser
-    assert(d->msg->path);
-    assert(d->msg->member);
+    dh_clear(MethodIndex, &o->methods);
+    dv_clear(MethodEntry, &o->methodEntries);
+    free(o->methodNames);
+
+    // Copy all of the names into one block so the keys stay valid even if
+    // an interface replaces a member
+    d_Hash(Bind)* h = &o->interfaces;
+    size_t namesz = 0;
+    for (dh_Iter bi = dh_begin(h); bi != dh_end(h); ++bi) {
+        if (dh_exist(h, bi)) {
+            d_Hash(MemberPtr)* mh = &dh_val(h, bi)->interface->members[ADBUSI_METHOD];
+            for (dh_Iter mi = dh_begin(mh); mi != dh_end(mh); ++mi) {
+                if (dh_exist(mh, mi)) {
+                    namesz += dh_val(mh, mi)->name.sz + 1;
+                }
+            }
+        }
+    }
+
+    char* names = (char*) malloc(namesz + 1);
+    o->methodNames = names;
+
+    for (dh_Iter bi = dh_begin(h); bi != dh_end(h); ++bi) {
+        if (!dh_exist(h, bi))
+            continue;
+
+        adbus_ConnBind* b = dh_val(h, bi);
+        d_Hash(MemberPtr)* mh = &b->interface->members[ADBUSI_METHOD];
+        for (dh_Iter mi = dh_begin(mh); mi != dh_end(mh); ++mi) {
+            if (!dh_exist(mh, mi))
+                continue;
+
+            adbus_Member* m = dh_val(mh, mi);
+            dh_strsz_t name = {names, m->name.sz};
+            memcpy(names, m->name.str, m->name.sz);
+            names[m->name.sz] = '\0';
+            names += m->name.sz + 1;
+
+            int added;
+            dh_Iter ei = dh_put(MethodIndex, &o->methods, name, &added);
+
+            struct MethodEntry* e = dv_push(MethodEntry, &o->methodEntries, 1);
+            size_t index = dv_size(&o->methodEntries) - 1;
+            e->bind     = b;
+            e->member   = m;
+            e->version  = b->interface->version;
+            e->next     = ADBUSI_NO_METHOD;
+            e->last     = index;
+
+            if (added) {
+                dh_key(&o->methods, ei) = name;
+                dh_val(&o->methods, ei) = index;
+            } else {
+                // Append to the end of the chain
+                struct MethodEntry* first = &dv_a(&o->methodEntries, dh_val(&o->methods, ei));
+                dv_a(&o->methodEntries, first->last).next = index;
+                first->last = index;
+            }
+        }
+    }
+
+    o->methodsDirty = 0;
+}
+
+// ----------------------------------------------------------------------------
+
+// Returns whether a bind also handles the paths below its own path. The
+// builtin interfaces follow along once a path has any fallback binds.
+adbus_Bool adbusI_servesSubpath(adbus_ConnBind* b)
+{
+    struct ObjectPath* o = b->path;
+    adbus_Connection* c = o->connection;
+    return b->fallback
+        || (o->fallbacks > 0
+            && (b->interface == c->introspectable || b->interface == c->properties));
+}
+
+// ----------------------------------------------------------------------------
+
+adbus_ConnBind* adbusI_pathBind(
+        struct ObjectPath*      o,
+        const adbus_Message*    msg,
+        const char*             interface,
+        size_t                  interfaceSize)
+{
+    dh_strsz_t istr = {interface, interfaceSize};
+    dh_Iter bi = dh_get(Bind, &o->interfaces, istr);
+    if (bi == dh_end(&o->interfaces))
+        return NULL;
+
+    adbus_ConnBind* b = dh_val(&o->interfaces, bi);
+    if (msg->pathSize != o->pathSize && !adbusI_servesSubpath(b))
+        return NULL;
+
+    return b;
+}
+
+// ----------------------------------------------------------------------------
+
+static adbus_Member* LookupMethod(
+        struct ObjectPath*      o,
+        const adbus_Message*    msg,
+        adbus_ConnBind**        bind)
+{
+    if (o->methodsDirty) {
+        BuildMethodTable(o);
+    }
+
+    dh_strsz_t mstr = {msg->member, msg->memberSize};
+    dh_Iter mi = dh_get(MethodIndex, &o->methods, mstr);
+    if (mi == dh_end(&o->methods))
+        return NULL;
+
+    adbus_Bool subpath = (msg->pathSize != o->pathSize);
+
+    size_t ei = dh_val(&o->methods, mi);
+    while (ei != ADBUSI_NO_METHOD) {
+        struct MethodEntry* e = &dv_a(&o->methodEntries, ei);
+        adbus_Interface* i = e->bind->interface;
+        ei = e->next;
+
+        if (    msg->interface
+            &&  (   i->name.sz != msg->interfaceSize
+                ||  memcmp(i->name.str, msg->interface, msg->interfaceSize) != 0))
+        {
+            continue;
+        }
+
+        if (subpath && !adbusI_servesSubpath(e->bind))
+            continue;
+
+        // The interface has changed since the table was built, so the member
+        // may have been freed
+        if (e->version != i->version) {
+            o->methodsDirty = 1;
+            return NULL;
+        }
+
+        *bind = e->bind;
+        return e->member;
+    }
+
+    return NULL;
+}
+
+// ----------------------------------------------------------------------------
 
-    adbus_Member* member;
-    adbus_ConnBind* bind;
+static adbus_Member* FindMethod(
+        struct ObjectPath*      o,
+        const adbus_Message*    msg,
+        adbus_ConnBind**        bind,
+        adbus_Bool*             haveInterface)
+{
+    adbus_Member* member = LookupMethod(o, msg, bind);
+    if (member) {
+        *haveInterface = 1;
+        return member;
+    }
 
-    if (d->msg->interface) {
+    // Not in the table, so either there is no such method or the table is
+    // out of date. Fall back to searching the binds directly.
+
+    if (msg->interface) {
         // If we know the interface, then we try and find the method on that
         // interface
-        adbus_Interface* interface = adbus_conn_interface(
-                d->connection,
-                d->msg->path,
-                d->msg->pathSize,
-                d->msg->interface,
-                (int) d->msg->interfaceSize,
-                &bind);
-
-        if (!interface) {
-            return adbusI_interfaceError(d);
-        }
+        adbus_ConnBind* b = adbusI_pathBind(o, msg, msg->interface, msg->interfaceSize);
+        if (!b)
+            return NULL;
 
-        member = adbus_iface_method(
-                interface,
-                d->msg->member,
-                (int) d->msg->memberSize);
+        *haveInterface = 1;
+        member = adbus_iface_method(b->interface, msg->member, (int) msg->memberSize);
+        *bind = b;
 
     } else {
         // We don't know the interface, try and find the first method on any
         // interface with the member name
-        member = adbus_conn_method(
-                d->connection,
-                d->msg->path,
-                d->msg->pathSize,
-                d->msg->member,
-                (int) d->msg->memberSize,
-                &bind);
+        adbus_Bool subpath = (msg->pathSize != o->pathSize);
+        d_Hash(Bind)* h = &o->interfaces;
+        for (dh_Iter bi = dh_begin(h); bi != dh_end(h) && !member; ++bi) {
+            if (dh_exist(h, bi)) {
+                adbus_ConnBind* b = dh_val(h, bi);
+                if (!subpath || adbusI_servesSubpath(b)) {
+                    member = adbus_iface_method(b->interface, msg->member, (int) msg->memberSize);
+                    *bind = b;
+                }
+            }
+        }
+    }
+
+    if (member) {
+        o->methodsDirty = 1;
+    }
+
+    return member;
+}
+
+// ----------------------------------------------------------------------------
+
+int adbusI_dispatchBind(adbus_CbData* d)
+{
+    // should have been checked by parser
+    assert(d->msg->path);
+    assert(d->msg->member);
+
+    adbus_Connection* c = d->connection;
+    struct ObjectPath* fallback = NULL;
+    struct ObjectPath* o = adbusI_lookupPath(
+            c,
+            d->msg->path,
+            d->msg->pathSize,
+            c->fallbacks > 0 ? &fallback : NULL);
+
+    // Paths which only exist as the parent of other paths (ie only have the
+    // builtin interfaces) are handled by a fallback above them if there is
+    // one
+    if ((!o || dh_size(&o->interfaces) <= 2) && fallback) {
+        o = fallback;
+    }
 
+    adbus_ConnBind* bind = NULL;
+    adbus_Member* member = NULL;
+    adbus_Bool haveInterface = 0;
+
+    if (o) {
+        member = FindMethod(o, d->msg, &bind, &haveInterface);
     }
 
-    if (!member)
+    if (!member && d->msg->interface && !haveInterface) {
+        return adbusI_interfaceError(d);
+    } else if (!member) {
         return adbusI_methodError(d);
+    }
 
     return adbus_mbr_call(member, bind, d);
 }
@@ -422,15 +743,12 @@ adbus_Interface* adbus_conn_interface(
     if (interfaceSize < 0)
         interfaceSize = strlen(interface);
 
-    dh_strsz_t pstr = {path, pathSize};
     dh_strsz_t istr = {interface, interfaceSize};
 
-    dh_Iter oi = dh_get(ObjectPath, &c->paths, pstr);
-    if (oi == dh_end(&c->paths))
+    struct ObjectPath* o = adbusI_lookupPath(c, path, pathSize, NULL);
+    if (!o)
         return NULL;
 
-    struct ObjectPath* o = dh_val(&c->paths, oi);
-
     dh_Iter bi = dh_get(Bind, &o->interfaces, istr);
     if (bi == dh_end(&o->interfaces))
         return NULL;
@@ -458,13 +776,10 @@ adbus_Member* adbus_conn_method(
     if (methodSize < 0)
         methodSize = strlen(method);
 
-    dh_strsz_t pstr = {path, pathSize};
-
-    dh_Iter oi = dh_get(ObjectPath, &c->paths, pstr);
-    if (oi == dh_end(&c->paths))
+    struct ObjectPath* o = adbusI_lookupPath(c, path, pathSize, NULL);
+    if (!o)
         return NULL;
 
-    struct ObjectPath* o = dh_val(&c->paths, oi);
     d_Hash(Bind)* h = &o->interfaces;
 
     for (dh_Iter bi = dh_begin(h); bi != dh_end(h); ++bi) {
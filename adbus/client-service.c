@@ -207,6 +207,47 @@ struct ServiceLookup* adbusI_lookupService(
 
 /* -------------------------------------------------------------------------- */
 
+static int RemoteDisconnected(adbus_CbData* d)
+{
+    size_t namesz, tosz;
+    const char* name = adbus_check_string(d, &namesz);
+    adbus_check_string(d, NULL);
+    adbus_check_string(d, &tosz);
+    adbus_check_end(d);
+
+    if (*name == ':' && tosz == 0) {
+        if (ADBUS_TRACE_MATCH) {
+            adbusI_log("remote disconnected %s", name);
+        }
+
+        dh_strsz_t remote = {name, namesz};
+        adbusI_failRemote(d->connection, remote);
+    }
+
+    return 0;
+}
+
+void adbusI_watchRemotes(adbus_Connection* c)
+{
+    c->watchingRemotes = 1;
+
+    // NameOwnerChanged(name, old owner, new owner) with new owner = ""
+    adbus_Argument args[3];
+    adbus_arg_init(args, 3);
+    args[2].value = "";
+    args[2].size  = 0;
+
+    adbus_Match m;
+    adbus_match_init(&m);
+    m.arguments     = args;
+    m.argumentsSize = 3;
+    m.callback      = &RemoteDisconnected;
+
+    adbus_proxy_signal(c->bus, &m, "NameOwnerChanged", -1);
+}
+
+/* -------------------------------------------------------------------------- */
+
 void adbusI_freeServiceLookup(struct ServiceLookup* s)
 {
     if (s) {
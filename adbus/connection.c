@@ -32,6 +32,7 @@
 #include "dmem/string.h"
 
 #include <assert.h>
+#include <limits.h>
 
 /** \struct adbus_ConnectionCallbacks
  *  \brief Structure to hold callbacks registered with adbus_conn_new(). 
@@ -57,6 +58,28 @@
     \endcode
  */
 
+/** \var adbus_ConnectionCallbacks::send_messages
+ *  \brief Optional callback to send a batch of queued messages.
+
+    This is only used if queueing has been enabled with
+    adbus_conn_setqueue(). The callback should write out all of the messages
+    in order (eg with a single writev) and return the total number of bytes
+    written or -1 on error.
+
+    For example: 
+    \code
+    adbus_ssize_t SendMsgs(void* user, adbus_SharedMsg** msgs, size_t num)
+    {
+        struct iovec iov[num];
+        for (size_t i = 0; i < num; i++) {
+            iov[i].iov_base = (void*) msgs[i]->data;
+            iov[i].iov_len  = msgs[i]->size;
+        }
+        return writev(*(adbus_Socket*) user, iov, num);
+    }
+    \endcode
+ */
+
 /** \var adbus_ConnectionCallbacks::proxy 
  *
  *
@@ -108,6 +131,19 @@
     \endcode
  */
 
+/** \var adbus_ConnectionCallbacks::block
+ *  \brief Optional callback to block the current thread.
+
+    This is used by adbus_conn_block() to run the application's own event
+    loop. For ADBUS_BLOCK and ADBUS_WAIT_FOR_CONNECTED it should process
+    events until ADBUS_UNBLOCK is called or the connection has connected
+    respectively, or until \a timeoutms milliseconds have passed (-1 for no
+    timeout). It should return non-zero if the timeout was hit or on error.
+
+    If not set, adbus_conn_block() reads and dispatches messages off the
+    socket set with adbus_conn_setsocket() itself.
+ */
+
 /** \struct adbus_Connection
  *
     \brief Client message dispatcher
@@ -254,8 +290,9 @@ adbus_Connection* adbus_conn_new(adbus_ConnectionCallbacks* cb, void* user)
 
     adbus_Connection* c = NEW(adbus_Connection);
 
-    c->nextSerial   = 1;
+    c->nextSerial   = 0;
     c->connected    = 0;
+    c->sock         = ADBUS_SOCK_INVALID;
 
     c->returnMessage    = adbus_msg_new();
 
@@ -276,6 +313,8 @@ adbus_Connection* adbus_conn_new(adbus_ConnectionCallbacks* cb, void* user)
     adbus_mbr_setmethod(m, &adbusI_introspect, NULL);
     adbus_mbr_retsig(m, "s", -1);
 
+    adbus_iface_freeze(c->introspectable);
+
 
     c->properties = adbus_iface_new("org.freedesktop.DBus.Properties", -1);
 
@@ -299,6 +338,8 @@ adbus_Connection* adbus_conn_new(adbus_ConnectionCallbacks* cb, void* user)
     adbus_mbr_argname(m, "property_name", -1);
     adbus_mbr_argname(m, "value", -1);
 
+    adbus_iface_freeze(c->properties);
+
     adbus_conn_ref(c);
 
     return c;
@@ -346,14 +387,9 @@ void adbus_conn_deref(adbus_Connection* c)
         // replies, and matches so that the bind etc free methods dont try and
         // disconnect from the lookup tables. 
 
-        for (dh_Iter ii = dh_begin(&c->paths); ii != dh_end(&c->paths); ++ii) {
-            if (dh_exist(&c->paths, ii)){
-                struct ObjectPath* p = dh_val(&c->paths, ii);
-                p->connection = NULL;
-                adbusI_freeObjectPath(p);
-            }
+        if (c->root) {
+            adbusI_freeObjectPath(c->root);
         }
-        dh_clear(ObjectPath, &c->paths);
 
         for (dh_Iter ri = dh_begin(&c->remotes); ri != dh_end(&c->remotes); ++ri) {
             if (dh_exist(&c->remotes, ri)) {
@@ -378,6 +414,8 @@ void adbus_conn_deref(adbus_Connection* c)
             adbusI_freeReply(r);
         }
 
+        adbusI_freeMatchIndexes(c);
+
         adbus_ConnMatch* m;
         DIL_FOREACH(Match, m, &c->matches, hl) {
             adbusI_freeMatch(m);
@@ -390,11 +428,10 @@ void adbus_conn_deref(adbus_Connection* c)
         assert(dil_isempty(&c->replies));
         assert(dil_isempty(&c->matches));
         assert(dh_size(&c->services) == 0);
-        assert(dh_size(&c->paths) == 0);
+        assert(c->root == NULL);
         assert(dh_size(&c->remotes) == 0);
 
         dh_free(ServiceLookup, &c->services);
-        dh_free(ObjectPath, &c->paths);
         dh_free(Remote, &c->remotes);
 
         adbus_state_free(c->state);
@@ -404,6 +441,9 @@ void adbus_conn_deref(adbus_Connection* c)
         adbus_iface_free(c->properties);
 
         adbus_msg_free(c->returnMessage);
+        adbusI_mpsc_take(&c->sendStack, &c->queue);
+        adbusI_queue_free(&c->queue);
+        adbusI_arena_free(&c->arena);
 
         free(c->uniqueService);
 
@@ -417,16 +457,21 @@ void adbus_conn_deref(adbus_Connection* c)
 // Message
 // ----------------------------------------------------------------------------
 
+static void FlushOnThread(void* u)
+{
+    adbus_Connection* c = (adbus_Connection*) u;
+    adbus_conn_flush(c);
+    adbus_conn_deref(c);
+}
+
 /** Sends a message on the connection
  *  \relates adbus_Connection
  *  
- *  This function is thread safe and may be called in both callbacks and
- *  on other threads.
+ *  This function may be called in callbacks. If adbus_conn_setthreaded() has
+ *  been enabled it may also be called on other threads.
  *
  *  \note Do not call this is in method call callback for replies. Instead
  *  setup your response in the provided msg factory (adbus_CbData::ret).
- *
- *  \todo Actually make this thread safe.
  */
 int adbus_conn_send(
         adbus_Connection* c,
@@ -438,6 +483,19 @@ int adbus_conn_send(
 
     assert(message->serial != 0);
 
+    if (c->threaded && !(c->callbacks.should_proxy && !c->callbacks.should_proxy(c->user))) {
+        // Only the first message after the connection thread has emptied
+        // the queue needs to wake it up
+        if (adbusI_mpsc_push(&c->sendStack, message) && c->callbacks.proxy) {
+            adbus_conn_ref(c);
+            c->callbacks.proxy(c->user, &FlushOnThread, c);
+        }
+        return 0;
+    }
+
+    if (c->queue.threshold > 0)
+        return adbusI_queue_push(&c->queue, message, c->callbacks.send_messages, c->user);
+
     if (!c->callbacks.send_message)
         return -1;
 
@@ -450,19 +508,144 @@ int adbus_conn_send(
 
 // ----------------------------------------------------------------------------
 
+/** Enables or disables queueing of outgoing messages.
+ *  \relates adbus_Connection
+ *
+ *  When enabled, adbus_conn_send() queues messages instead of sending them
+ *  immediately. The queue is flushed via
+ *  adbus_ConnectionCallbacks::send_messages (which must be set) when the
+ *  queued data reaches \a threshold bytes, at the end of adbus_conn_parse(),
+ *  or by an explicit call to adbus_conn_flush().
+ *
+ *  A threshold of 0 flushes any queued messages and disables queueing.
+ */
+void adbus_conn_setqueue(adbus_Connection* c, size_t threshold)
+{
+    assert(threshold == 0 || c->callbacks.send_messages);
+
+    if (threshold == 0) {
+        adbus_conn_flush(c);
+    }
+
+    c->queue.threshold = threshold;
+}
+
+// ----------------------------------------------------------------------------
+
+/** Sends any queued messages.
+ *  \relates adbus_Connection
+ *
+ *  This includes any messages sent on other threads (see
+ *  adbus_conn_setthreaded()), which are written out in a single batch.
+ *
+ *  \return non-zero on error
+ *
+ *  \sa adbus_conn_setqueue()
+ */
+int adbus_conn_flush(adbus_Connection* c)
+{
+    if (c->sendStack) {
+        adbusI_mpsc_take(&c->sendStack, &c->queue);
+    }
+    return adbusI_queue_flush(&c->queue, c->callbacks.send_messages, c->user);
+}
+
+// ----------------------------------------------------------------------------
+
+/** Enables or disables sending messages from other threads.
+ *  \relates adbus_Connection
+ *
+ *  When enabled adbus_conn_send() and adbus_msg_send() may be called on any
+ *  thread, with each thread using its own adbus_MsgFactory. Messages sent off
+ *  the connection thread are copied onto a lock free queue, which the
+ *  connection thread writes out as a single batch via
+ *  adbus_ConnectionCallbacks::send_messages (which must be set) on the next
+ *  adbus_conn_flush(), including the one at the end of adbus_conn_parse().
+ *  The first message queued after a flush also posts a flush over to the
+ *  connection thread via adbus_ConnectionCallbacks::proxy if that is set.
+ *
+ *  A send is considered to be on the connection thread if
+ *  adbus_ConnectionCallbacks::should_proxy is set and returns false. Without
+ *  should_proxy every message is queued.
+ *
+ *  Serials from adbus_conn_serial() are always allocated atomically.
+ *
+ *  \warning Only the send itself is thread safe. Anything that registers for
+ *  a reply or otherwise changes the connection's state must still be called
+ *  on the connection thread (or proxied over to it). This includes
+ *  adbus_call_send() with a reply or error callback, adbus_conn_addreply(),
+ *  adbus_conn_addmatch() and adbus_sig_emit(), which reuses the signal's
+ *  message factory.
+ *
+ *  This must be called on the connection thread before any other thread
+ *  starts sending. Disabling it flushes any queued messages.
+ */
+void adbus_conn_setthreaded(adbus_Connection* c, adbus_Bool enable)
+{
+    assert(!enable || c->callbacks.send_messages);
+
+    if (!enable) {
+        adbus_conn_flush(c);
+    }
+
+    c->threaded = enable;
+}
+
+// ----------------------------------------------------------------------------
+
+/** Enables or disables the per message scratch arena.
+ *  \relates adbus_Connection
+ *
+ *  Dispatching a message needs some temporary space (eg the argument array
+ *  for matching match rules and formatted error messages). When the arena is
+ *  enabled this is bump allocated from a block kept by the connection and
+ *  reset after each message, so that once the block has grown to fit the
+ *  largest message dispatch needs no mallocs. When disabled each allocation
+ *  is a separate malloc.
+ *
+ *  This must not be called from within a callback.
+ *
+ *  \sa adbus_conn_arenastats()
+ */
+void adbus_conn_setarena(adbus_Connection* c, adbus_Bool enable)
+{ adbusI_arena_enable(&c->arena, enable); }
+
+// ----------------------------------------------------------------------------
+
+/** Gets statistics on the per message scratch allocations.
+ *  \relates adbus_Connection
+ *
+ *  \param[in]  c           The connection.
+ *  \param[out] messages    Number of messages dispatched.
+ *  \param[out] mallocs     Number of heap allocations made for scratch space.
+ *
+ *  The outputs may be NULL if that value is not needed.
+ *
+ *  \sa adbus_conn_setarena()
+ */
+void adbus_conn_arenastats(adbus_Connection* c, size_t* messages, size_t* mallocs)
+{
+    if (messages)
+        *messages = c->arenaMessages;
+    if (mallocs)
+        *mallocs = c->arena.mallocs;
+}
+
+// ----------------------------------------------------------------------------
+
 /** Gets a serial that can be used for sending messages.
  *  \relates adbus_Connection
  *  
  *  \note This function is thread safe and may be called in both callbacks and
  *  on other threads.
- *
- *  \todo Actually make this thread safe.
  */
 uint32_t adbus_conn_serial(adbus_Connection* c)
 {
-    if (c->nextSerial == UINT32_MAX)
-        c->nextSerial = 1;
-    return c->nextSerial++;
+    uint32_t serial;
+    do {
+        serial = (uint32_t) adbus_InterlockedIncrement(&c->nextSerial);
+    } while (serial == 0);
+    return serial;
 }
 
 
@@ -540,15 +723,26 @@ int adbus_conn_dispatch(
     d.msg           = message;
     d.ret           = c->returnMessage;
 
-    if (Dispatch(&d))
-        return -1;
+    // Arguments parsed during dispatch are allocated from the arena, so are
+    // only valid until we return
+    adbus_Bool haveargs = (message->arguments != NULL);
+    adbusI_arena_begin(&c->arena);
+    c->arenaMessages++;
+
+    int ret = Dispatch(&d);
 
     // Send off reply if needed
-    if (d.ret) {
+    if (!ret && d.ret) {
         adbus_msg_send(d.ret, c);
     }
 
-    return 0;
+    if (!haveargs) {
+        message->arguments = NULL;
+        message->argumentsSize = 0;
+    }
+    adbusI_arena_end(&c->arena);
+
+    return ret ? -1 : 0;
 }
 
 // ----------------------------------------------------------------------------
@@ -559,6 +753,9 @@ int adbus_conn_dispatch(
  *  This will remove all complete messages from the beginning of the buffer,
  *  but it will leave incomplete messages in the buffer. These should be
  *  appended to once more data comes in and then recall this function.
+ *
+ *  If queueing is enabled (see adbus_conn_setqueue()) the queue is flushed
+ *  after the messages have been dispatched.
  */
 int adbus_conn_parse(
         adbus_Connection*   c,
@@ -569,34 +766,86 @@ int adbus_conn_parse(
     size_t size = adbus_buf_size(buf);
 
     adbus_Message m;
+    size_t msgsize;
+    int ret = 0;
+
+    struct ParseState state;
+    struct ParseState* prevstate = c->parse;
+    ZERO(&state);
+    c->parse = &state;
+
+    // An outer parse may have a message in parseBuffer that it is still
+    // dispatching
+    d_Vector(char) nested;
+    d_Vector(char)* aligned = prevstate ? &nested : &c->parseBuffer;
+    ZERO(&nested);
 
     while (1) {
-        size_t msgsize = adbus_parse_size(data, size);
+        msgsize = adbus_parse_size(data, size);
         if (msgsize == 0 || msgsize > size)
             break;
 
+        state.next = data + msgsize;
+        state.left = size - msgsize;
+
         if (ADBUS_ALIGN(data, 8) == (uintptr_t) data) {
-            if (adbus_parse(&m, data, msgsize))
-                return -1;
-            if (adbus_conn_dispatch(c, &m))
-                return -1;
+            if (adbus_parse(&m, data, msgsize) || adbus_conn_dispatch(c, &m)) {
+                ret = -1;
+                break;
+            }
 
         } else {
-            char* dest = dv_push(char, &c->parseBuffer, msgsize);
+            char* dest = dv_push(char, aligned, msgsize);
             memcpy(dest, data, msgsize);
-            if (adbus_parse(&m, dest, msgsize))
-                return -1;
-            if (adbus_conn_dispatch(c, &m))
-                return -1;
-            dv_clear(char, &c->parseBuffer);
+            if (adbus_parse(&m, dest, msgsize) || adbus_conn_dispatch(c, &m)) {
+                ret = -1;
+                break;
+            }
+            dv_clear(char, aligned);
         }
 
         data += msgsize;
         size -= msgsize;
+
+        if (state.stolen) {
+            // A callback blocked and received more data into the stolen
+            // buffer, which now holds everything after this message
+            adbus_buf_remove(buf, 0, adbus_buf_size(buf));
+            adbus_buf_append(buf, adbus_buf_data(state.stolen), adbus_buf_size(state.stolen));
+            adbus_buf_free(state.stolen);
+            state.stolen = NULL;
+            data = adbus_buf_data(buf);
+            size = adbus_buf_size(buf);
+        }
+
+        // Leave the rest for later if this was the message adbus_conn_block
+        // was waiting for
+        if (c->blockDone && *c->blockDone) {
+            msgsize = 0;
+            break;
+        }
+    }
+
+    c->parse = prevstate;
+    dv_free(char, &nested);
+
+    if (state.stolen) {
+        adbus_buf_free(state.stolen);
     }
 
+    if (ret)
+        return -1;
+
     adbus_buf_remove(buf, 0, adbus_buf_size(buf) - size);
-    return 0;
+
+    // If we have the start of the next message then make room for the rest of
+    // it, so that it is received in place rather than regrowing the buffer
+    // and then copying it to parseBuffer to align it
+    if (msgsize > size && msgsize <= ADBUSI_MAXIMUM_MESSAGE_LENGTH)
+        adbusI_buf_reservemsg(buf, msgsize);
+
+    // Send out any replies generated by the dispatched messages
+    return adbus_conn_flush(c);
 }
 
 // ----------------------------------------------------------------------------
@@ -654,3 +903,174 @@ void adbus_conn_getproxy(
             *user = NULL;
     }
 }
+
+// ----------------------------------------------------------------------------
+
+/** Sets the socket used by adbus_conn_block().
+ *  \relates adbus_Connection
+ *
+ *  \param[in] c        The connection.
+ *  \param[in] sock     An authenticated blocking socket connected to the bus.
+ *  \param[in] buf      The buffer used to receive data off the socket. If the
+ *                      application also reads the socket itself it should
+ *                      use the same buffer so that partially received
+ *                      messages are not lost.
+ *
+ *  This is only needed if adbus_ConnectionCallbacks::block is not set.
+ *
+ *  \sa adbus_conn_block(), adbus_call_block()
+ */
+void adbus_conn_setsocket(adbus_Connection* c, adbus_Socket sock, adbus_Buffer* buf)
+{
+    c->sock     = sock;
+    c->sockbuf  = buf;
+}
+
+// ----------------------------------------------------------------------------
+
+/** Blocks the current thread.
+ *  \relates adbus_Connection
+ *
+ *  \param[in] c            The connection.
+ *  \param[in] type         ADBUS_BLOCK to block until a matching
+ *                          ADBUS_UNBLOCK (eg from a reply callback),
+ *                          ADBUS_WAIT_FOR_CONNECTED to block until the hello
+ *                          reply has come back, or ADBUS_UNBLOCK.
+ *  \param[in] timeoutms    Timeout in milliseconds or -1 for no timeout.
+ *
+ *  \return non-zero on timeout or error
+ *
+ *  If adbus_ConnectionCallbacks::block is set this just forwards on to it.
+ *  Otherwise it waits on the socket set with adbus_conn_setsocket() using
+ *  poll and dispatches incoming messages until it is unblocked, stopping as
+ *  soon as the message that unblocks it has been dispatched. Any messages
+ *  after that are left in the buffer. Reply timeouts (see
+ *  adbus_conn_timeout()) are serviced whilst waiting.
+ *
+ *  This may be called from within a callback.
+ *
+ *  \sa adbus_call_block()
+ */
+int adbus_conn_block(adbus_Connection* c, adbus_BlockType type, int timeoutms)
+{
+    if (c->callbacks.block)
+        return c->callbacks.block(c->user, type, timeoutms);
+
+    if (type == ADBUS_UNBLOCK) {
+        if (c->unblock) {
+            *c->unblock = 1;
+        }
+        return 0;
+
+    } else if (type == ADBUS_WAIT_FOR_CONNECTED) {
+        return adbusI_block(c, &c->connected, timeoutms);
+
+    } else {
+        adbus_Bool unblocked = 0;
+        adbus_Bool* prev = c->unblock;
+        c->unblock = &unblocked;
+        int ret = adbusI_block(c, &unblocked, timeoutms);
+        c->unblock = prev;
+        return ret;
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+static int BlockOnSocket(
+        adbus_Connection*   c,
+        adbus_Buffer*       buf,
+        const adbus_Bool*   done,
+        int64_t             end)
+{
+    // Dispatch anything that is already in the buffer first
+    if (adbus_conn_parse(c, buf))
+        return -1;
+
+    while (!*done) {
+        if (adbus_conn_flush(c))
+            return -1;
+
+        int wait = adbus_conn_timeout(c);
+        if (*done)
+            break;
+
+        if (end >= 0) {
+            int64_t left = end - adbusI_clock();
+            if (left <= 0)
+                return -1;
+            if (wait < 0 || left < wait) {
+                wait = (int) left;
+            }
+        }
+
+        adbus_ssize_t recvd = adbusI_sock_recv(c->sock, buf, wait);
+        if (recvd < 0)
+            return -1;
+
+        if (recvd > 0 && adbus_conn_parse(c, buf))
+            return -1;
+    }
+
+    return 0;
+}
+
+/* Blocks until *done is set. Without a block callback we loop over the socket
+ * ourselves, otherwise we run the application's loop until either done is set
+ * or the timeout is hit (other replies may unblock it early).
+ */
+int adbusI_block(adbus_Connection* c, const adbus_Bool* done, int timeoutms)
+{
+    int64_t end = timeoutms >= 0 ? adbusI_clock() + timeoutms : -1;
+
+    if (c->callbacks.block) {
+        while (!*done) {
+            int wait = -1;
+            if (end >= 0) {
+                int64_t left = end - adbusI_clock();
+                if (left <= 0)
+                    return -1;
+                wait = left > INT_MAX ? INT_MAX : (int) left;
+            }
+            if (c->callbacks.block(c->user, ADBUS_BLOCK, wait))
+                return -1;
+        }
+        return 0;
+    }
+
+    if (c->sock == ADBUS_SOCK_INVALID || !c->sockbuf)
+        return -1;
+
+    if (*done)
+        return 0;
+
+    // If we are in a callback from adbus_conn_parse, take over the rest of
+    // its data. A second block from the same callback carries on with the
+    // buffer the first one stole.
+    adbus_Buffer* buf = c->sockbuf;
+    if (c->parse) {
+        if (!c->parse->stolen) {
+            c->parse->stolen = adbus_buf_new();
+            adbus_buf_append(c->parse->stolen, c->parse->next, c->parse->left);
+        }
+        buf = c->parse->stolen;
+    }
+
+    const adbus_Bool* prevdone = c->blockDone;
+    c->blockDone = done;
+
+    int ret = BlockOnSocket(c, buf, done, end);
+
+    c->blockDone = prevdone;
+    return ret;
+}
+
+/* Wakes up the block callback. The socket loop checks the done flag after
+ * every message so doesn't need to be told.
+ */
+void adbusI_unblock(adbus_Connection* c)
+{
+    if (c->callbacks.block) {
+        c->callbacks.block(c->user, ADBUS_UNBLOCK, -1);
+    }
+}
@@ -49,25 +49,88 @@ struct adbus_ConnBind
     void*                   ruser[2];
     adbus_ProxyCallback     relproxy;
     void*                   relpuser;
+    adbus_Bool              fallback;
+    adbus_ChildrenCallback  children;
 };
 
 
-DVECTOR_INIT(ObjectPath, struct ObjectPath*);
+DLIST_INIT(ObjectPath, struct ObjectPath);
 DHASH_MAP_INIT_STRSZ(ObjectPath, struct ObjectPath*);
 DHASH_MAP_INIT_STRSZ(Bind, adbus_ConnBind*);
 
+/* Each object path keeps a table from method name to the methods of that name
+ * on each of its binds so that dispatching a method call is a single lookup
+ * after finding the path. Entries with the same name are chained through
+ * next (an index into methodEntries) in the same order as the binds are
+ * iterated, so that the first match is the same bind the fallback search
+ * would find. The first entry of each chain also holds the index of the last
+ * entry in last so new entries can be appended. The table is rebuilt lazily once
+ * methodsDirty is set by a bind or unbind. Each entry also records the
+ * version of its interface so that changes to an interface after it is bound
+ * are caught when the entry is used.
+ */
+
+#define ADBUSI_NO_METHOD ((size_t) -1)
+
+struct MethodEntry
+{
+    adbus_ConnBind*         bind;
+    adbus_Member*           member;
+    long                    version;
+    size_t                  next;
+    size_t                  last;
+};
+
+DVECTOR_INIT(MethodEntry, struct MethodEntry);
+DHASH_MAP_INIT_STRSZ(MethodIndex, size_t);
+
+/* The object paths form a tree with one node per path segment rooted at
+ * adbus_Connection::root. Each node only stores its own segment (allocated
+ * with the node). Finding a path is a walk down the tree with one hash lookup
+ * per segment. The children of a node are also kept in a list so they can
+ * be enumerated and unlinked without searching.
+ */
+
 struct ObjectPath
 {
     adbus_Connection*       connection;
-    dh_strsz_t              path;
-    d_Hash(Bind)            interfaces;
-    d_Vector(ObjectPath)    children;
     struct ObjectPath*      parent;
+
+    // Last segment of the path ie "bar" for "/foo/bar" and "" for "/"
+    dh_strsz_t              name;
+    // Length of the full path
+    size_t                  pathSize;
+
+    d_Hash(ObjectPath)      children;
+    d_List(ObjectPath)      childList;
+    d_List(ObjectPath)      siblings;
+
+    d_Hash(Bind)            interfaces;
+
+    // Cached reply to Introspect, empty when it needs to be regenerated
+    d_String                introspection;
+    long                    introspectionVersion;
+
+    // Method dispatch table, see above. The keys point into methodNames.
+    d_Hash(MethodIndex)     methods;
+    d_Vector(MethodEntry)   methodEntries;
+    char*                   methodNames;
+    adbus_Bool              methodsDirty;
+
+    // Number of fallback binds on this path
+    size_t                  fallbacks;
 };
 
 ADBUSI_FUNC void adbusI_freeBind(adbus_ConnBind* bind);
-// This does not free the binds themselves, but rather resets the path pointer
-// of all the binds
+ADBUSI_FUNC adbus_Bool adbusI_servesSubpath(adbus_ConnBind* bind);
+// Returns the object at path or NULL. If fallback is non-null it is set to
+// the deepest object above path that has fallback binds (or NULL).
+ADBUSI_FUNC struct ObjectPath* adbusI_lookupPath(adbus_Connection* c, const char* path, size_t pathSize, struct ObjectPath** fallback);
+// Finds the bind for an interface on the object path handling msg (which may
+// be a fallback path above msg->path)
+ADBUSI_FUNC adbus_ConnBind* adbusI_pathBind(struct ObjectPath* p, const adbus_Message* msg, const char* interface, size_t interfaceSize);
+// This frees the path and all of the paths below it. It does not free the
+// binds themselves, but rather resets the path pointer of all the binds
 ADBUSI_FUNC void adbusI_freeObjectPath(struct ObjectPath* p);
 
 // ----------------------------------------------------------------------------
@@ -140,12 +203,40 @@ struct ServiceLookup
 
 ADBUSI_FUNC void adbusI_freeServiceLookup(struct ServiceLookup* service);
 
-/* The match lookup is simply a linked list of matches which we run through
- * checking the message against each match. Every message runs through this
- * list.
+/* All matches are kept in a linked list so they can be freed with the
+ * connection. For dispatch the matches are also indexed so that an incoming
+ * message only has to be checked against the matches that could possibly
+ * match it. Each match is in exactly one index:
+ * - Matches with a path are in pathMatches keyed on the path.
+ * - Matches with a member but no path are in memberMatches keyed on
+ *   "<interface> <member>" (with an empty interface if the match does not
+ *   specify one).
+ * - Everything else is in the residual otherMatches list.
+ *
+ * A message is delivered to every match that matches, so dispatch is a loop
+ * over the few index vectors the message could be in. Callbacks may remove
+ * matches whilst we are looping over the vectors. In that case the match's
+ * slot is cleared and the index is put on the dirtyMatches list. The dirty
+ * indexes are compacted (and freed if empty) once the outermost dispatch
+ * finishes.
  */
 
+struct MatchIndex;
+
 DILIST_INIT(Match, adbus_ConnMatch);
+DVECTOR_INIT(ConnMatch, adbus_ConnMatch*);
+DHASH_MAP_INIT_STRSZ(MatchIndex, struct MatchIndex*);
+DVECTOR_INIT(MatchIndex, struct MatchIndex*);
+
+struct MatchIndex
+{
+    d_Vector(ConnMatch)     matches;
+    // Table the index is in or NULL for the connection's otherMatches
+    d_Hash(MatchIndex)*     table;
+    adbus_Bool              dirty;
+    dh_strsz_t              key;
+    char                    data[1];
+};
 
 struct adbus_ConnMatch
 {
@@ -154,9 +245,14 @@ struct adbus_ConnMatch
     adbus_State*            state;
     adbus_Proxy*            proxy;
     struct ServiceLookup*   service;
+
+    adbus_Connection*       connection;
+    struct MatchIndex*      index;
+    size_t                  indexPos;
 };
 
 ADBUSI_FUNC void adbusI_freeMatch(adbus_ConnMatch* m);
+ADBUSI_FUNC void adbusI_freeMatchIndexes(adbus_Connection* c);
 
 /* For replies we have an optimised match lookup. The connection holds a hash
  * table of sender -> Remote. The Remote then holds a hash table of reply
@@ -187,10 +283,32 @@ struct adbus_ConnReply
 
     adbus_ProxyCallback         relproxy;
     void*                       relpuser;
+
+    // Link in the connection's timeout wheel. deadline is 0 if the reply has
+    // no timeout.
+    adbus_Connection*           connection;
+    d_IList(Reply)              tl;
+    int64_t                     deadline;
 };
 
 ADBUSI_FUNC void adbusI_freeReply(adbus_ConnReply* reply);
 
+/* Replies with a timeout are also put in a hierarchical timing wheel on the
+ * connection with 1 ms ticks. Level n holds replies whose deadline differs
+ * from wheelTime first in bits [6n, 6n+6) and is indexed by those bits of the
+ * deadline. As adbus_conn_timeout advances wheelTime, the slots that have been
+ * passed at each level are emptied and their replies either expire or are
+ * reinserted at a lower level. Deadlines further out than the top level
+ * covers (about 4.6 hours) are clamped and reinserted when reached.
+ */
+
+enum
+{
+    ADBUSI_WHEEL_BITS   = 6,
+    ADBUSI_WHEEL_SLOTS  = 1 << ADBUSI_WHEEL_BITS,
+    ADBUSI_WHEEL_LEVELS = 4,
+};
+
 DHASH_MAP_INIT_UINT32(Reply, adbus_ConnReply*);
 
 struct Remote
@@ -198,12 +316,44 @@ struct Remote
     adbus_Connection*           connection;
     dh_strsz_t                  name;
     d_Hash(Reply)               replies;
+    // Set whilst adbusI_failRemote is going through the replies so that the
+    // remote is not freed when the last reply is removed
+    adbus_Bool                  failing;
 };
 
 ADBUSI_FUNC struct Remote* adbusI_getRemote(adbus_Connection* c, const char* name);
 // This does not free the replies themselves but rather resets the remote pointer
 ADBUSI_FUNC void adbusI_freeRemote(struct Remote* remote);
 
+/* Once we have a reply registered against a unique name, we watch for
+ * NameOwnerChanged signals with an empty new owner (ie a name going away).
+ * When a unique name goes away, all of the replies for that remote are failed
+ * in one go with a NoReply error. As with service lookups this match is kept
+ * for the life of the connection.
+ */
+ADBUSI_FUNC void adbusI_watchRemotes(adbus_Connection* c);
+ADBUSI_FUNC void adbusI_failRemote(adbus_Connection* c, dh_strsz_t name);
+
+// ----------------------------------------------------------------------------
+
+/* Each adbus_conn_parse keeps a ParseState on the stack pointing to the data
+ * after the message it is currently dispatching. The parse still has
+ * pointers into its buffer during the callback, so if a callback blocks,
+ * adbusI_block copies that remaining data out into the stolen buffer and
+ * receives into that instead. Once the callback returns the parse swaps the
+ * stolen buffer's contents back into its own and carries on from there.
+ */
+
+struct ParseState
+{
+    const char*                 next;
+    size_t                      left;
+    adbus_Buffer*               stolen;
+};
+
+ADBUSI_FUNC int adbusI_block(adbus_Connection* c, const adbus_Bool* done, int timeoutms);
+ADBUSI_FUNC void adbusI_unblock(adbus_Connection* c);
+
 // ----------------------------------------------------------------------------
 
 DHASH_MAP_INIT_STRSZ(Remote, struct Remote*);
@@ -215,7 +365,7 @@ struct adbus_Connection
     /** \privatesection */
     volatile long               ref;
 
-    d_Hash(ObjectPath)          paths;
+    struct ObjectPath*          root;
     d_Hash(Remote)              remotes;
 
     // We keep free lists for all registrable services so that they can be
@@ -224,10 +374,25 @@ struct adbus_Connection
     d_IList(Match)              matches;
     d_IList(Reply)              replies;
     d_IList(Bind)               binds;
+    size_t                      fallbacks;
+
+    d_IList(Reply)              timeouts[ADBUSI_WHEEL_LEVELS][ADBUSI_WHEEL_SLOTS];
+    size_t                      timeoutCount;
+    int64_t                     wheelTime;
+
+    d_Hash(MatchIndex)          pathMatches;
+    d_Hash(MatchIndex)          memberMatches;
+    struct MatchIndex           otherMatches;
+    d_Vector(MatchIndex)        dirtyMatches;
+    int                         matchDispatchDepth;
+    d_String                    matchKey;
+    size_t                      matchMessages;
+    size_t                      matchesExamined;
 
     d_Hash(ServiceLookup)       services;
+    adbus_Bool                  watchingRemotes;
 
-    uint32_t                    nextSerial;
+    long volatile               nextSerial;
     adbus_Bool                  connected;
     char*                       uniqueService;
 
@@ -245,6 +410,23 @@ struct adbus_Connection
 
     d_Vector(char)              parseBuffer;
     adbus_MsgFactory*           returnMessage;
+
+    adbusI_SendQueue            queue;
+
+    // Messages sent on other threads when adbus_conn_setthreaded is enabled
+    adbus_Bool                  threaded;
+    adbusI_QueuedMsg* volatile  sendStack;
+
+    // Used by adbus_conn_block when there is no block callback
+    adbus_Socket                sock;
+    adbus_Buffer*               sockbuf;
+    struct ParseState*          parse;
+    const adbus_Bool*           blockDone;
+    adbus_Bool*                 unblock;
+
+    // Scratch space for the message currently being dispatched
+    adbusI_Arena                arena;
+    size_t                      arenaMessages;
 };
 
 
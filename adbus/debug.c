@@ -290,6 +290,8 @@ static void BindString(d_String* s, const adbus_Bind* b)
         ds_cat_f(s, "%-15s %p %p\n", "Release 0", b->release[0], b->ruser[0]);
     if (b->release[1])
         ds_cat_f(s, "%-15s %p %p\n", "Release 1", b->release[1], b->ruser[1]);
+    if (b->fallback)
+        ds_cat_f(s, "%-15s %p\n", "Fallback", b->children);
 }
 
 void adbusI_logbind(const char* header, const adbus_Bind* b)
@@ -0,0 +1,206 @@
+/* vim: ts=4 sw=4 sts=4 et
+ *
+ * Copyright (c) 2009 James R. McKaskill
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * ----------------------------------------------------------------------------
+ */
+
+#define ADBUS_LIBRARY
+#include "misc.h"
+
+/* --------------------------------------------------------------------------
+ * Bulk endian flipping of arrays of fixed size values (eg "ad", "au").
+ *
+ * These are flipped with SSE2 shuffles or AVX2 byte shuffles a block at a
+ * time when available with a scalar loop for the tail and as the fallback.
+ * The kernels are chosen in the same way as the validation kernels.
+ */
+
+#ifdef ADBUSI_HAVE_SSE2
+#   include <emmintrin.h>
+#endif
+
+#ifdef ADBUSI_HAVE_AVX2
+#   include <immintrin.h>
+#endif
+
+struct Kernels
+{
+    // Flip size bytes of 2, 4, or 8 byte values
+    void (*flip16)(char* p, size_t size);
+    void (*flip32)(char* p, size_t size);
+    void (*flip64)(char* p, size_t size);
+};
+
+// ----------------------------------------------------------------------------
+
+static void Flip16Scalar(char* p, size_t size)
+{
+    uint16_t* v   = (uint16_t*) p;
+    uint16_t* end = (uint16_t*) (p + size);
+    for (; v < end; v++) {
+        *v = ADBUSI_FLIP16(*v);
+    }
+}
+
+static void Flip32Scalar(char* p, size_t size)
+{
+    uint32_t* v   = (uint32_t*) p;
+    uint32_t* end = (uint32_t*) (p + size);
+    for (; v < end; v++) {
+        *v = ADBUSI_FLIP32(*v);
+    }
+}
+
+static void Flip64Scalar(char* p, size_t size)
+{
+    uint64_t* v   = (uint64_t*) p;
+    uint64_t* end = (uint64_t*) (p + size);
+    for (; v < end; v++) {
+        *v = ADBUSI_FLIP64(*v);
+    }
+}
+
+#ifndef ADBUSI_HAVE_SSE2
+static const struct Kernels sScalar = {&Flip16Scalar, &Flip32Scalar, &Flip64Scalar};
+#endif
+
+// ----------------------------------------------------------------------------
+
+#ifdef ADBUSI_HAVE_SSE2
+// SSE2 has no byte shuffle so the 32 and 64 bit values first have their 16
+// bit words reversed and then the bytes in each word are swapped.
+ADBUS_INLINE __m128i Swap16SSE2(__m128i x)
+{ return _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8)); }
+
+ADBUS_INLINE __m128i Swap32SSE2(__m128i x)
+{
+    x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(2,3,0,1));
+    x = _mm_shufflehi_epi16(x, _MM_SHUFFLE(2,3,0,1));
+    return Swap16SSE2(x);
+}
+
+ADBUS_INLINE __m128i Swap64SSE2(__m128i x)
+{
+    x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(0,1,2,3));
+    x = _mm_shufflehi_epi16(x, _MM_SHUFFLE(0,1,2,3));
+    return Swap16SSE2(x);
+}
+
+#define FLIP_SSE2(name, swap, scalar)                               \
+    static void name(char* p, size_t size)                          \
+    {                                                               \
+        size_t i = 0;                                               \
+        for (; i + 16 <= size; i += 16) {                           \
+            __m128i x = _mm_loadu_si128((const __m128i*) (p + i));  \
+            _mm_storeu_si128((__m128i*) (p + i), swap(x));          \
+        }                                                           \
+        scalar(p + i, size - i);                                    \
+    }
+
+FLIP_SSE2(Flip16SSE2, Swap16SSE2, Flip16Scalar)
+FLIP_SSE2(Flip32SSE2, Swap32SSE2, Flip32Scalar)
+FLIP_SSE2(Flip64SSE2, Swap64SSE2, Flip64Scalar)
+
+static const struct Kernels sSSE2 = {&Flip16SSE2, &Flip32SSE2, &Flip64SSE2};
+#endif
+
+// ----------------------------------------------------------------------------
+
+#ifdef ADBUSI_HAVE_AVX2
+static const char sSwap16[16] = {1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14};
+static const char sSwap32[16] = {3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12};
+static const char sSwap64[16] = {7,6,5,4,3,2,1,0,15,14,13,12,11,10,9,8};
+
+// Shuffles each 32 byte block using the 16 byte mask for both lanes. Returns
+// the number of bytes flipped.
+__attribute__((target("avx2")))
+static size_t ShuffleAVX2(char* p, size_t size, const char* mask)
+{
+    __m256i m = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*) mask));
+    size_t i = 0;
+    for (; i + 64 <= size; i += 64) {
+        __m256i x0 = _mm256_loadu_si256((const __m256i*) (p + i));
+        __m256i x1 = _mm256_loadu_si256((const __m256i*) (p + i + 32));
+        _mm256_storeu_si256((__m256i*) (p + i), _mm256_shuffle_epi8(x0, m));
+        _mm256_storeu_si256((__m256i*) (p + i + 32), _mm256_shuffle_epi8(x1, m));
+    }
+    for (; i + 32 <= size; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i*) (p + i));
+        _mm256_storeu_si256((__m256i*) (p + i), _mm256_shuffle_epi8(x, m));
+    }
+    return i;
+}
+
+#define FLIP_AVX2(name, mask, scalar)                               \
+    static void name(char* p, size_t size)                          \
+    {                                                               \
+        size_t i = ShuffleAVX2(p, size, mask);                      \
+        scalar(p + i, size - i);                                    \
+    }
+
+FLIP_AVX2(Flip16AVX2, sSwap16, Flip16Scalar)
+FLIP_AVX2(Flip32AVX2, sSwap32, Flip32Scalar)
+FLIP_AVX2(Flip64AVX2, sSwap64, Flip64Scalar)
+
+static const struct Kernels sAVX2 = {&Flip16AVX2, &Flip32AVX2, &Flip64AVX2};
+#endif
+
+// ----------------------------------------------------------------------------
+
+ADBUS_INLINE const struct Kernels* GetKernels(void)
+{
+#ifdef ADBUSI_HAVE_AVX2
+    if (adbusI_cpuHasAVX2())
+        return &sAVX2;
+#endif
+#ifdef ADBUSI_HAVE_SSE2
+    return &sSSE2;
+#else
+    return &sScalar;
+#endif
+}
+
+// ----------------------------------------------------------------------------
+
+/* Endian flips an array of fixed size values in place. The data must be
+ * aligned to, and size must be a multiple of the value width (2, 4, or 8).
+ */
+void adbusI_flipArray(char* data, size_t size, int width)
+{
+    const struct Kernels* k = GetKernels();
+    switch (width)
+    {
+        case 2:
+            k->flip16(data, size);
+            break;
+        case 4:
+            k->flip32(data, size);
+            break;
+        case 8:
+            k->flip64(data, size);
+            break;
+        default:
+            assert(0);
+            break;
+    }
+}
+
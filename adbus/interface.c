@@ -344,6 +344,7 @@ void adbus_iface_ref(adbus_Interface* interface)
 // ----------------------------------------------------------------------------
 
 static void FreeMember(adbus_Member* member);
+static void FreeTables(adbus_Interface* i);
 
 /** Derefs an interface.
  *  \relates adbus_Interface
@@ -355,11 +356,15 @@ void adbus_iface_deref(adbus_Interface* i)
             adbusI_log("free interface %s", i->name);
         }
 
-        for (dh_Iter ii = dh_begin(&i->members); ii != dh_end(&i->members); ++ii) {
-            if (dh_exist(&i->members, ii))
-                FreeMember(dh_val(&i->members, ii));
+        for (int j = 0; j < 3; j++) {
+            d_Hash(MemberPtr)* h = &i->members[j];
+            for (dh_Iter ii = dh_begin(h); ii != dh_end(h); ++ii) {
+                if (dh_exist(h, ii))
+                    FreeMember(dh_val(h, ii));
+            }
+            dh_free(MemberPtr, h);
         }
-        dh_free(MemberPtr, &i->members);
+        FreeTables(i);
 
         free((char*) i->name.str);
         free(i);
@@ -377,21 +382,29 @@ static adbus_Member* AddMethod(
     if (size < 0)
         size = strlen(name);
 
+    // Members can not be added once the interface is frozen, but if they are
+    // we need to drop the tables as they may point to a replaced member
+    assert(!i->frozen);
+    FreeTables(i);
+
     adbus_Member* m = NEW(adbus_Member);
     m->interface    = i;
     m->type         = type;
     m->name.str     = adbusI_strndup(name, size);
     m->name.sz      = size;
 
+    d_Hash(MemberPtr)* h = &i->members[type];
+
     int ret;
-    dh_Iter ki = dh_put(MemberPtr, &i->members, m->name, &ret);
+    dh_Iter ki = dh_put(MemberPtr, h, m->name, &ret);
     if (!ret) {
-        FreeMember(dh_val(&i->members, ki));
+        FreeMember(dh_val(h, ki));
     }
 
-    dh_key(&i->members, ki) = m->name;
-    dh_val(&i->members, ki) = m;
+    dh_key(h, ki) = m->name;
+    dh_val(h, ki) = m;
 
+    i->version++;
     return m;
 }
 
@@ -462,6 +475,164 @@ static void FreeMember(adbus_Member* m)
 
 // ----------------------------------------------------------------------------
 
+static uint32_t HashName(uint32_t seed, const char* str, size_t sz)
+{
+    // FNV-1a with the seed mixed into the offset basis and a final mix so
+    // that the low bits are usable with a mask
+    uint32_t h = 2166136261U ^ seed;
+    for (size_t i = 0; i < sz; i++) {
+        h ^= (uint8_t) str[i];
+        h *= 16777619U;
+    }
+    h ^= h >> 16;
+    h *= 0x85EBCA6BU;
+    h ^= h >> 13;
+    return h;
+}
+
+static uint32_t TableSlot(struct MemberTable* t, uint32_t hash)
+{
+    return (hash + t->displace[(hash >> 16) & t->bucketMask]) & t->mask;
+}
+
+// Tries to place all of the members in bucket b with displacement d. This
+// undoes any partial placement on failure.
+static adbus_Bool PlaceBucket(
+        struct MemberTable* t,
+        adbus_Member**      list,
+        uint32_t*           hashes,
+        size_t              num,
+        uint32_t            b,
+        uint32_t            d)
+{
+    for (size_t k = 0; k < num; k++) {
+        if (((hashes[k] >> 16) & t->bucketMask) != b)
+            continue;
+
+        adbus_Member** slot = &t->members[(hashes[k] + d) & t->mask];
+        if (*slot) {
+            for (size_t j = 0; j < k; j++) {
+                if (((hashes[j] >> 16) & t->bucketMask) == b) {
+                    t->members[(hashes[j] + d) & t->mask] = NULL;
+                }
+            }
+            return 0;
+        }
+
+        *slot = list[k];
+    }
+
+    return 1;
+}
+
+static adbus_Bool FillTable(
+        struct MemberTable* t,
+        adbus_Member**      list,
+        uint32_t*           hashes,
+        size_t              num)
+{
+    memset(t->members, 0, (t->mask + 1) * sizeof(adbus_Member*));
+
+    for (size_t k = 0; k < num; k++) {
+        hashes[k] = HashName(t->seed, list[k]->name.str, list[k]->name.sz);
+    }
+
+    for (uint32_t b = 0; b <= t->bucketMask; b++) {
+        uint32_t d = 0;
+        while (!PlaceBucket(t, list, hashes, num, b, d)) {
+            if (d++ == t->mask)
+                return 0;
+        }
+        t->displace[b] = d;
+    }
+
+    return 1;
+}
+
+static void BuildTable(
+        struct MemberTable* t,
+        adbus_Interface*    i,
+        adbusI_MemberType   type)
+{
+    d_Hash(MemberPtr)* h = &i->members[type];
+    size_t num = dh_size(h);
+    if (num == 0)
+        return;
+
+    adbus_Member** list = NEW_ARRAY(adbus_Member*, num);
+    uint32_t* hashes = NEW_ARRAY(uint32_t, num);
+
+    num = 0;
+    for (dh_Iter mi = dh_begin(h); mi != dh_end(h); ++mi) {
+        if (dh_exist(h, mi)) {
+            list[num++] = dh_val(h, mi);
+        }
+    }
+
+    // Use a table at most half full with on average two members per bucket.
+    // A seed that doesn't work almost always means two members in the same
+    // bucket have the same slot, so we just try the next one.
+    size_t size = 2;
+    while (size < 2 * num) {
+        size *= 2;
+    }
+
+    for (;;) {
+        size_t buckets = size >= 4 ? size / 4 : 1;
+        t->members = NEW_ARRAY(adbus_Member*, size);
+        t->displace = NEW_ARRAY(uint32_t, buckets);
+        t->mask = (uint32_t) (size - 1);
+        t->bucketMask = (uint32_t) (buckets - 1);
+
+        for (t->seed = 0; t->seed < 256; t->seed++) {
+            if (FillTable(t, list, hashes, num))
+                goto end;
+        }
+
+        free(t->members);
+        free(t->displace);
+        size *= 2;
+    }
+
+end:
+    free(list);
+    free(hashes);
+}
+
+static void FreeTables(adbus_Interface* i)
+{
+    for (int j = 0; j < 3; j++) {
+        free(i->tables[j].members);
+        free(i->tables[j].displace);
+    }
+    ZERO(&i->tables);
+    i->frozen = 0;
+}
+
+/** Freezes the member set of an interface to speed up member lookups.
+ *  \relates adbus_Interface
+ *
+ *  This compiles the methods, signals, and properties into separate perfect
+ *  hash tables so that looking up a member (eg on every method call) is a
+ *  single hash and compare.
+ *
+ *  Members may still be modified (eg adding arguments or annotations) after
+ *  freezing, but no more members can be added.
+ *
+ *  \note This should be called after adding the members and before the
+ *  interface is bound or shared with other threads.
+ */
+void adbus_iface_freeze(adbus_Interface* i)
+{
+    FreeTables(i);
+    BuildTable(&i->tables[ADBUSI_METHOD], i, ADBUSI_METHOD);
+    BuildTable(&i->tables[ADBUSI_SIGNAL], i, ADBUSI_SIGNAL);
+    BuildTable(&i->tables[ADBUSI_PROPERTY], i, ADBUSI_PROPERTY);
+    i->frozen = 1;
+}
+
+// ----------------------------------------------------------------------------
+
 static adbus_Member* GetMethod(
         adbus_Interface*      i,
         adbusI_MemberType     type,
@@ -473,15 +644,24 @@ static adbus_Member* GetMethod(
         size >= 0 ? (size_t) size : strlen(name),
     };
 
-    dh_Iter ii = dh_get(MemberPtr, &i->members, mstr);
-    if (ii == dh_end(&i->members))
-        return NULL;
+    if (i->frozen) {
+        struct MemberTable* t = &i->tables[type];
+        if (!t->members)
+            return NULL;
 
-    adbus_Member* m = dh_val(&i->members, ii);
-    if (m->type != type)
+        adbus_Member* m = t->members[TableSlot(t, HashName(t->seed, mstr.str, mstr.sz))];
+        if (!m || m->name.sz != mstr.sz || memcmp(m->name.str, mstr.str, mstr.sz) != 0)
+            return NULL;
+
+        return m;
+    }
+
+    d_Hash(MemberPtr)* h = &i->members[type];
+    dh_Iter ii = dh_get(MemberPtr, h, mstr);
+    if (ii == dh_end(h))
         return NULL;
 
-    return m;
+    return dh_val(h, ii);
 }
 
 /** Gets a method.
@@ -522,6 +702,8 @@ void adbus_mbr_argsig(adbus_Member* m, const char* sig, int size)
         ds_cat_n(&m->argsig, sig, size);
     else
         ds_cat(&m->argsig, sig);
+
+    m->interface->version++;
 }
 
 // ----------------------------------------------------------------------------
@@ -544,6 +726,8 @@ void adbus_mbr_argname(adbus_Member* m, const char* name, int size)
 
     char** pstr = dv_push(String, &m->arguments, 1);
     *pstr = adbusI_strndup(name, size);
+
+    m->interface->version++;
 }
 
 // ----------------------------------------------------------------------------
@@ -564,6 +748,8 @@ void adbus_mbr_retsig(adbus_Member* m, const char* sig, int size)
         ds_cat_n(&m->retsig, sig, size);
     else
         ds_cat(&m->retsig, sig);
+
+    m->interface->version++;
 }
 
 // ----------------------------------------------------------------------------
@@ -587,6 +773,8 @@ void adbus_mbr_retname(adbus_Member* m, const char* name, int size)
 
     char** pstr = dv_push(String, &m->returns, 1);
     *pstr = adbusI_strndup(name, size);
+
+    m->interface->version++;
 }
 
 // ----------------------------------------------------------------------------
@@ -618,6 +806,8 @@ void adbus_mbr_annotate(
 
     dh_key(&m->annotations, ki) = name;
     dh_val(&m->annotations, ki) = (char*) value;
+
+    m->interface->version++;
 }
 
 // ----------------------------------------------------------------------------
@@ -677,6 +867,9 @@ void adbus_mbr_setgetter(
 {
     m->getPropertyCallback = callback;
     m->getPropertyData     = user1;
+
+    // The access shown in the introspection depends on which callbacks are set
+    m->interface->version++;
 }
 
 // ----------------------------------------------------------------------------
@@ -696,6 +889,8 @@ void adbus_mbr_setsetter(
 {
     m->setPropertyCallback = callback;
     m->setPropertyData     = user1;
+
+    m->interface->version++;
 }
 
 // ----------------------------------------------------------------------------
@@ -870,51 +1065,127 @@ static void IntrospectMember(adbus_Member* m, d_String* out)
 
 // ----------------------------------------------------------------------------
 
-static void IntrospectInterfaces(struct ObjectPath* p, d_String* out)
+static void IntrospectInterfaces(struct ObjectPath* p, adbus_Bool subpath, d_String* out)
 {
     for (dh_Iter bi = dh_begin(&p->interfaces); bi != dh_end(&p->interfaces); ++bi) {
-        if (dh_exist(&p->interfaces, bi)) {
-            adbus_Interface* i = dh_val(&p->interfaces, bi)->interface;
-            ds_cat(out, "\t<interface name=\"");
-            ds_cat_n(out, i->name.str, i->name.sz);
-            ds_cat(out, "\">\n");
-
-            for (dh_Iter mi = dh_begin(&i->members); mi != dh_end(&i->members); ++mi) {
-                if (dh_exist(&i->members, mi)) {
-                    IntrospectMember(dh_val(&i->members, mi), out);
+        if (!dh_exist(&p->interfaces, bi))
+            continue;
+
+        adbus_ConnBind* b = dh_val(&p->interfaces, bi);
+        if (subpath && !adbusI_servesSubpath(b))
+            continue;
+
+        adbus_Interface* i = b->interface;
+        ds_cat(out, "\t<interface name=\"");
+        ds_cat_n(out, i->name.str, i->name.sz);
+        ds_cat(out, "\">\n");
+
+        for (int j = 0; j < 3; j++) {
+            d_Hash(MemberPtr)* h = &i->members[j];
+            for (dh_Iter mi = dh_begin(h); mi != dh_end(h); ++mi) {
+                if (dh_exist(h, mi)) {
+                    IntrospectMember(dh_val(h, mi), out);
                 }
             }
-
-            ds_cat(out, "\t</interface>\n");
         }
+
+        ds_cat(out, "\t</interface>\n");
     }
 }
 
 // ----------------------------------------------------------------------------
 
-static void IntrospectNode(struct ObjectPath* p, d_String* out)
+static int CompareNames(const void* a, const void* b)
+{
+    return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+// ----------------------------------------------------------------------------
+
+static adbus_Bool IsRegisteredChild(struct ObjectPath* p, const char* name, size_t sz)
+{
+    if (!p)
+        return 0;
+
+    dh_strsz_t key = {name, sz};
+    return dh_get(ObjectPath, &p->children, key) != dh_end(&p->children);
+}
+
+// ----------------------------------------------------------------------------
+
+// p is the object handling the introspection and node is the object at the
+// introspected path (if there is one)
+static void IntrospectNode(
+        struct ObjectPath*      p,
+        struct ObjectPath*      node,
+        const adbus_Message*    msg,
+        d_String*               out)
 {
+    adbus_Bool subpath = (msg->pathSize != p->pathSize);
+
     ds_cat(out,
            "<!DOCTYPE node PUBLIC \"-//freedesktop/DTD D-BUS Object Introspection 1.0//EN\"\n"
            "\"http://www.freedesktop.org/standards/dbus/1.0/introspect.dtd\">\n"
            "<node>\n");
 
-    IntrospectInterfaces(p, out);
+    IntrospectInterfaces(p, subpath, out);
 
-    size_t namelen = p->path.sz;
-    // Now add the child objects
-    for (size_t i = 0; i < dv_size(&p->children); ++i) {
-        // Find the child tail ie ("bar" for "/foo/bar" or "foo" for "/foo")
-        const char* child = dv_a(&p->children, i)->path.str;
-        child += namelen;
-        if (namelen > 1)
-            child += 1; // +1 for '/' when p is not the root node
+    // Now add the child objects in order
+    if (node && dh_size(&node->children) > 0) {
+        d_Vector(String) names;
+        ZERO(&names);
 
-        ds_cat(out, "\t<node name=\"");
-        ds_cat(out, child);
-        ds_cat(out, "\"/>\n");
+        struct ObjectPath* child;
+        DL_FOREACH(ObjectPath, child, &node->childList, siblings) {
+            *dv_push(String, &names, 1) = (char*) child->name.str;
+        }
+
+        qsort(dv_data(&names), dv_size(&names), sizeof(char*), &CompareNames);
+
+        for (size_t i = 0; i < dv_size(&names); ++i) {
+            ds_cat(out, "\t<node name=\"");
+            ds_cat(out, dv_a(&names, i));
+            ds_cat(out, "\"/>\n");
+        }
+
+        dv_free(String, &names);
     }
 
+    // And any children listed by the binds
+    adbus_Buffer* buf = NULL;
+    for (dh_Iter bi = dh_begin(&p->interfaces); bi != dh_end(&p->interfaces); ++bi) {
+        if (!dh_exist(&p->interfaces, bi))
+            continue;
+
+        adbus_ConnBind* b = dh_val(&p->interfaces, bi);
+        if (!b->children || (subpath && !adbusI_servesSubpath(b)))
+            continue;
+
+        if (!buf) {
+            buf = adbus_buf_new();
+        }
+
+        adbus_buf_reset(buf);
+        b->children(b->cuser2, msg->path, msg->pathSize, buf);
+
+        const char* child = adbus_buf_data(buf);
+        const char* end = child + adbus_buf_size(buf);
+        while (child < end) {
+            const char* nul = (const char*) memchr(child, '\0', end - child);
+            if (!nul)
+                break;
+
+            if (nul > child && !IsRegisteredChild(node, child, nul - child)) {
+                ds_cat(out, "\t<node name=\"");
+                ds_cat_n(out, child, nul - child);
+                ds_cat(out, "\"/>\n");
+            }
+            child = nul + 1;
+        }
+    }
+
+    adbus_buf_free(buf);
+
     ds_cat(out, "</node>\n");
 }
 
@@ -931,15 +1202,51 @@ int adbusI_introspect(adbus_CbData* d)
 
     struct ObjectPath* p = (struct ObjectPath*) d->user2;
 
-    d_String out;
-    ZERO(&out);
-    IntrospectNode(p, &out);
+    // The cached XML is cleared when binds or children are added or removed.
+    // Changes to the bound interfaces themselves are picked up by the sum of
+    // their versions, which only ever increases. Paths with children
+    // callbacks can't be cached.
+    long version = 0;
+    adbus_Bool cache = 1;
+    for (dh_Iter bi = dh_begin(&p->interfaces); bi != dh_end(&p->interfaces); ++bi) {
+        if (dh_exist(&p->interfaces, bi)) {
+            adbus_ConnBind* b = dh_val(&p->interfaces, bi);
+            version += b->interface->version;
+            if (b->children) {
+                cache = 0;
+            }
+        }
+    }
 
     adbus_msg_setsig(d->ret, "s", 1);
-    adbus_msg_string(d->ret, ds_cstr(&out), ds_size(&out));
-    adbus_msg_end(d->ret);
 
-    ds_free(&out);
+    if (d->msg->pathSize != p->pathSize || !cache) {
+        // Fallback path - the introspected path may have children of its own
+        // but we don't want to create an object for every path below the
+        // fallback
+        struct ObjectPath* node = adbusI_lookupPath(
+                p->connection,
+                d->msg->path,
+                d->msg->pathSize,
+                NULL);
+
+        d_String s;
+        ZERO(&s);
+        IntrospectNode(p, node, d->msg, &s);
+        adbus_msg_string(d->ret, ds_cstr(&s), ds_size(&s));
+        ds_free(&s);
+
+    } else {
+        if (ds_size(&p->introspection) == 0 || p->introspectionVersion != version) {
+            ds_clear(&p->introspection);
+            IntrospectNode(p, p, d->msg, &p->introspection);
+            p->introspectionVersion = version;
+        }
+
+        adbus_msg_string(d->ret, ds_cstr(&p->introspection), ds_size(&p->introspection));
+    }
+
+    adbus_msg_end(d->ret);
 
     return 0;
 }
@@ -981,19 +1288,14 @@ int adbusI_getProperty(adbus_CbData* d)
     adbus_check_end(d);
 
     // Get the interface
-    adbus_ConnBind* bind;
-    adbus_Interface* interface = adbus_conn_interface(
-            path->connection,
-            path->path.str,
-            path->path.sz,
-            iname,
-            isz,
-            &bind);
-
-    if (!interface) {
+    adbus_ConnBind* bind = adbusI_pathBind(path, d->msg, iname, isz);
+
+    if (!bind) {
         return adbusI_interfaceError(d);
     }
 
+    adbus_Interface* interface = bind->interface;
+
     // Get the property
     adbus_Member* mbr = adbus_iface_property(interface, mname, msz);
 
@@ -1033,14 +1335,10 @@ static int ProxiedGetAllProperties(adbus_CbData* d)
     adbus_msg_setsig(d->ret, "a{sv}", 5);
     adbus_msg_beginarray(d->ret, &a);
 
-    d_Hash(MemberPtr)* mbrs = &interface->members;
+    d_Hash(MemberPtr)* mbrs = &interface->members[ADBUSI_PROPERTY];
     for (dh_Iter mi = dh_begin(mbrs); mi != dh_end(mbrs); ++mi) {
         if (dh_exist(mbrs, mi)) {
             adbus_Member* mbr = dh_val(mbrs, mi);
-            // Check that it is a property
-            if (mbr->type != ADBUSI_PROPERTY) {
-                continue;
-            }
 
             // Check that we can read the property
             adbus_MsgCallback callback = mbr->getPropertyCallback;
@@ -1085,19 +1383,14 @@ int adbusI_getAllProperties(adbus_CbData* d)
     adbus_check_end(d);
 
     // Get the interface
-    adbus_ConnBind* bind;
-    adbus_Interface* interface = adbus_conn_interface(
-            path->connection,
-            path->path.str,
-            path->path.sz,
-            iname,
-            isz,
-            &bind);
-
-    if (!interface) {
+    adbus_ConnBind* bind = adbusI_pathBind(path, d->msg, iname, isz);
+
+    if (!bind) {
         return adbusI_interfaceError(d);
     }
 
+    adbus_Interface* interface = bind->interface;
+
     // If no reply is wanted we are finished
     if (!d->ret)
         return 0;
@@ -1138,19 +1431,14 @@ int adbusI_setProperty(adbus_CbData* d)
     const char* mname  = adbus_check_string(d, &msz);
 
     // Get the interface
-    adbus_ConnBind* bind;
-    adbus_Interface* interface = adbus_conn_interface(
-            path->connection,
-            path->path.str,
-            path->path.sz,
-            iname,
-            isz,
-            &bind);
-
-    if (!interface) {
+    adbus_ConnBind* bind = adbusI_pathBind(path, d->msg, iname, isz);
+
+    if (!bind) {
         return adbusI_interfaceError(d);
     }
 
+    adbus_Interface* interface = bind->interface;
+
     // Get the property
     adbus_Member* mbr = adbus_iface_property(interface, mname, msz);
 
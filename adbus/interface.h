@@ -75,12 +75,36 @@ DHASH_MAP_INIT_STRSZ(MemberPtr, adbus_Member*)
 
 // ----------------------------------------------------------------------------
 
+/* Perfect hash of the members of one type built by adbus_iface_freeze. The
+ * hash of a name picks a bucket (from the high bits) and a slot (from the low
+ * bits). Each bucket has a displacement added to the slot, chosen when
+ * building the table so that no two members land in the same slot. A lookup
+ * is then one hash and one compare.
+ */
+struct MemberTable
+{
+    adbus_Member**          members;
+    uint32_t*               displace;
+    uint32_t                mask;
+    uint32_t                bucketMask;
+    uint32_t                seed;
+};
+
 struct adbus_Interface
 {
     /** \privatesection */
     volatile long           ref;
     dh_strsz_t              name;
-    d_Hash(MemberPtr)       members;
+    // Indexed by adbusI_MemberType so that eg a method and a property can
+    // share a name
+    d_Hash(MemberPtr)       members[3];
+    // Bumped whenever a member is added or changed so that the introspection
+    // cached on each object path can tell when it is stale
+    long                    version;
+
+    // Lookup tables indexed by adbusI_MemberType, only valid when frozen
+    adbus_Bool              frozen;
+    struct MemberTable      tables[3];
 };
 
 // ----------------------------------------------------------------------------
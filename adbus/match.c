@@ -42,6 +42,9 @@
  *  through to the bus server. There are mostly used to register callbacks for
  *  signals from a specific remote object.
  *
+ *  An incoming message is delivered to every registered match that it
+ *  matches. Matches may be removed from within the callback.
+ *
  *  For example:
  *  \code
  *  static int Signal(adbus_CbData* d)
@@ -274,6 +277,169 @@ static void CloneMatch(const adbus_Match* from, adbus_Match* to)
 
 // ----------------------------------------------------------------------------
 
+static void PathKey(d_String* key, const char* path, size_t pathsz)
+{ ds_set_n(key, path, pathsz); }
+
+static void MemberKey(
+        d_String*   key,
+        const char* iface,
+        size_t      ifacesz,
+        const char* member,
+        size_t      membersz)
+{
+    // Interfaces and members can't contain spaces so the key is unambiguous
+    ds_set_n(key, iface ? iface : "", iface ? ifacesz : 0);
+    ds_cat_n(key, " ", 1);
+    ds_cat_n(key, member, membersz);
+}
+
+static d_Hash(MatchIndex)* IndexHash(adbus_Connection* c, adbus_Match* m, d_String* key)
+{
+    if (m->path) {
+        PathKey(key, m->path, m->pathSize);
+        return &c->pathMatches;
+    } else if (m->member) {
+        MemberKey(key, m->interface, m->interfaceSize, m->member, m->memberSize);
+        return &c->memberMatches;
+    } else {
+        return NULL;
+    }
+}
+
+static void AddToIndex(adbus_Connection* c, adbus_ConnMatch* m)
+{
+    struct MatchIndex* index = &c->otherMatches;
+
+    d_Hash(MatchIndex)* h = IndexHash(c, &m->m, &c->matchKey);
+    if (h) {
+        dh_strsz_t key;
+        key.str = ds_cstr(&c->matchKey);
+        key.sz  = ds_size(&c->matchKey);
+
+        int added;
+        dh_Iter ii = dh_put(MatchIndex, h, key, &added);
+        if (added) {
+            index = (struct MatchIndex*) calloc(1, sizeof(struct MatchIndex) + key.sz);
+            memcpy(index->data, key.str, key.sz);
+            index->table   = h;
+            index->key.str = index->data;
+            index->key.sz  = key.sz;
+            dh_key(h, ii) = index->key;
+            dh_val(h, ii) = index;
+        } else {
+            index = dh_val(h, ii);
+        }
+    }
+
+    m->connection = c;
+    m->index      = index;
+    m->indexPos   = dv_size(&index->matches);
+    *dv_push(ConnMatch, &index->matches, 1) = m;
+}
+
+static void FreeIndex(struct MatchIndex* index)
+{
+    if (index->table) {
+        dh_Iter ii = dh_get(MatchIndex, index->table, index->key);
+        assert(ii != dh_end(index->table));
+        dh_del(MatchIndex, index->table, ii);
+        dv_free(ConnMatch, &index->matches);
+        free(index);
+    }
+}
+
+static void CompactIndex(struct MatchIndex* index)
+{
+    size_t num = 0;
+    for (size_t i = 0; i < dv_size(&index->matches); i++) {
+        adbus_ConnMatch* m = dv_a(&index->matches, i);
+        if (m) {
+            m->indexPos = num;
+            dv_a(&index->matches, num++) = m;
+        }
+    }
+    dv_pop(ConnMatch, &index->matches, dv_size(&index->matches) - num);
+    index->dirty = 0;
+
+    if (num == 0) {
+        FreeIndex(index);
+    }
+}
+
+static void RemoveFromIndex(adbus_ConnMatch* m)
+{
+    adbus_Connection* c = m->connection;
+    if (c == NULL)
+        return;
+
+    struct MatchIndex* index = m->index;
+    d_Vector(ConnMatch)* v = &index->matches;
+
+    if (c->matchDispatchDepth > 0) {
+        // We may be in the middle of iterating over this index, so just clear
+        // the slot and compact the index after the dispatch.
+        dv_a(v, m->indexPos) = NULL;
+        if (!index->dirty) {
+            index->dirty = 1;
+            *dv_push(MatchIndex, &c->dirtyMatches, 1) = index;
+        }
+
+    } else {
+        // Swap the last match into our slot
+        adbus_ConnMatch* last = dv_a(v, dv_size(v) - 1);
+        dv_a(v, m->indexPos) = last;
+        last->indexPos = m->indexPos;
+        dv_pop(ConnMatch, v, 1);
+
+        if (dv_size(v) == 0) {
+            FreeIndex(index);
+        }
+    }
+
+    m->connection = NULL;
+    m->index = NULL;
+}
+
+static void DisconnectIndex(struct MatchIndex* index)
+{
+    for (size_t i = 0; i < dv_size(&index->matches); i++) {
+        adbus_ConnMatch* m = dv_a(&index->matches, i);
+        if (m) {
+            m->connection = NULL;
+            m->index = NULL;
+        }
+    }
+    dv_free(ConnMatch, &index->matches);
+}
+
+static void FreeIndexHash(d_Hash(MatchIndex)* h)
+{
+    for (dh_Iter ii = dh_begin(h); ii != dh_end(h); ++ii) {
+        if (dh_exist(h, ii)) {
+            struct MatchIndex* index = dh_val(h, ii);
+            DisconnectIndex(index);
+            free(index);
+        }
+    }
+    dh_free(MatchIndex, h);
+}
+
+/* Disconnects all matches from the lookup tables and frees the tables. This
+ * is used when freeing the connection so that adbusI_freeMatch doesn't try
+ * to remove the matches from the lookup tables.
+ */
+void adbusI_freeMatchIndexes(adbus_Connection* c)
+{
+    assert(c->matchDispatchDepth == 0);
+    FreeIndexHash(&c->pathMatches);
+    FreeIndexHash(&c->memberMatches);
+    DisconnectIndex(&c->otherMatches);
+    dv_free(MatchIndex, &c->dirtyMatches);
+    ds_free(&c->matchKey);
+}
+
+// ----------------------------------------------------------------------------
+
 adbus_ConnMatch* adbus_conn_addmatch(
         adbus_Connection*       c,
         const adbus_Match*      reg)
@@ -311,6 +477,7 @@ adbus_ConnMatch* adbus_conn_addmatch(
     }
 
     dil_insert_after(Match, &c->matches, m, &m->hl);
+    AddToIndex(c, m);
 
     return m;
 }
@@ -350,6 +517,7 @@ void adbus_conn_removematch(
 void adbusI_freeMatch(adbus_ConnMatch* m)
 {
     dil_remove(Match, m, &m->hl);
+    RemoveFromIndex(m);
 
     if (m->m.release[0]) {
         if (m->m.relproxy) {
@@ -431,51 +599,151 @@ static adbus_Bool ArgsMatch(
     return 1;
 }
 
+// Returns 1 if the match matches the message, 0 if not, and -1 on error
+static int CheckMatch(adbus_ConnMatch* m, adbus_Message* msg)
+{
+    if (m->m.type != ADBUS_MSG_INVALID && msg->type != m->m.type) {
+        return 0;
+    }
+
+    if (    m->m.replySerial >= 0
+        && (    !msg->replySerial 
+            ||  *msg->replySerial != m->m.replySerial))
+    {
+        return 0;
+    }
+
+    if (    (m->service && !Matches(m->service->unique.str, m->service->unique.sz, msg->sender, msg->senderSize))
+        ||  !Matches(m->m.sender, m->m.senderSize, msg->sender, msg->senderSize)
+        ||  !Matches(m->m.destination, m->m.destinationSize, msg->destination, msg->destinationSize)
+        ||  !Matches(m->m.interface, m->m.interfaceSize, msg->interface, msg->interfaceSize)
+        ||  !Matches(m->m.path, m->m.pathSize, msg->path, msg->pathSize)
+        ||  !Matches(m->m.member, m->m.memberSize, msg->member, msg->memberSize)
+        ||  !Matches(m->m.error, m->m.errorSize, msg->error, msg->errorSize))
+    {
+        return 0;
+    }
+
+    if (m->m.arguments) {
+        if (adbusI_parseargs(msg, &m->connection->arena))
+            return -1;
+        if (!ArgsMatch(&m->m, msg))
+            return 0;
+    }
+
+    return 1;
+}
+
+static struct MatchIndex* LookupIndex(d_Hash(MatchIndex)* h, d_String* key)
+{
+    dh_strsz_t k;
+    k.str = ds_cstr(key);
+    k.sz  = ds_size(key);
+    dh_Iter ii = dh_get(MatchIndex, h, k);
+    return ii != dh_end(h) ? dh_val(h, ii) : NULL;
+}
+
 int adbusI_dispatchMatch(adbus_CbData* d)
 {
     adbus_Connection* c = d->connection;
-    adbus_ConnMatch* m;
-    DIL_FOREACH(Match, m, &c->matches, hl) {
+    adbus_Message* msg = d->msg;
 
-        if (m->m.type != ADBUS_MSG_INVALID && d->msg->type != m->m.type) {
-            continue;
-        }
+    // Find the indexes that could contain matches for this message
+    struct MatchIndex* indexes[4];
+    int num = 0;
 
-        if (    m->m.replySerial >= 0
-            && (    !d->msg->replySerial 
-                ||  *d->msg->replySerial != m->m.replySerial))
-        {
-            continue;
-        }
+    indexes[num++] = &c->otherMatches;
 
-        if (    (m->service && !Matches(m->service->unique.str, m->service->unique.sz, d->msg->sender, d->msg->senderSize))
-            ||  !Matches(m->m.sender, m->m.senderSize, d->msg->sender, d->msg->senderSize)
-            ||  !Matches(m->m.destination, m->m.destinationSize, d->msg->destination, d->msg->destinationSize)
-            ||  !Matches(m->m.interface, m->m.interfaceSize, d->msg->interface, d->msg->interfaceSize)
-            ||  !Matches(m->m.path, m->m.pathSize, d->msg->path, d->msg->pathSize)
-            ||  !Matches(m->m.member, m->m.memberSize, d->msg->member, d->msg->memberSize)
-            ||  !Matches(m->m.error, m->m.errorSize, d->msg->error, d->msg->errorSize))
-        {
-            continue;
+    if (msg->path && dh_size(&c->pathMatches) > 0) {
+        PathKey(&c->matchKey, msg->path, msg->pathSize);
+        indexes[num] = LookupIndex(&c->pathMatches, &c->matchKey);
+        if (indexes[num])
+            num++;
+    }
+
+    if (msg->member && dh_size(&c->memberMatches) > 0) {
+        MemberKey(&c->matchKey, NULL, 0, msg->member, msg->memberSize);
+        indexes[num] = LookupIndex(&c->memberMatches, &c->matchKey);
+        if (indexes[num])
+            num++;
+
+        if (msg->interface) {
+            MemberKey(&c->matchKey, msg->interface, msg->interfaceSize, msg->member, msg->memberSize);
+            indexes[num] = LookupIndex(&c->memberMatches, &c->matchKey);
+            if (indexes[num])
+                num++;
         }
+    }
 
-        if (m->m.arguments) {
-            if (adbus_parseargs(d->msg))
-                return -1;
-            if (!ArgsMatch(&m->m, d->msg))
+    // Deliver to every matching match. Whilst matchDispatchDepth is set,
+    // removed matches are cleared from the index vectors rather than being
+    // removed and empty indexes are not freed. Matches added by the callbacks
+    // are appended past the end we took at the beginning so are not
+    // dispatched to until the next message.
+    int ret = 0;
+    size_t examined = 0;
+    c->matchDispatchDepth++;
+
+    for (int i = 0; i < num && !ret; i++) {
+        d_Vector(ConnMatch)* v = &indexes[i]->matches;
+        size_t sz = dv_size(v);
+        for (size_t j = 0; j < sz && !ret; j++) {
+            adbus_ConnMatch* m = dv_a(v, j);
+            if (m == NULL)
                 continue;
-        }
 
-        d->user1 = m->m.cuser;
+            examined++;
+            int check = CheckMatch(m, msg);
+            if (check < 0) {
+                ret = -1;
+            } else if (check > 0) {
+                d->user1 = m->m.cuser;
+                if (m->m.proxy) {
+                    ret = m->m.proxy(m->m.puser, m->m.callback, d);
+                } else {
+                    ret = adbus_dispatch(m->m.callback, d);
+                }
+            }
+        }
+    }
 
-        if (m->m.proxy) {
-            return m->m.proxy(m->m.puser, m->m.callback, d);
-        } else {
-            return adbus_dispatch(m->m.callback, d);
+    if (--c->matchDispatchDepth == 0) {
+        for (size_t i = 0; i < dv_size(&c->dirtyMatches); i++) {
+            CompactIndex(dv_a(&c->dirtyMatches, i));
         }
+        dv_clear(MatchIndex, &c->dirtyMatches);
+    }
+
+    c->matchMessages++;
+    c->matchesExamined += examined;
+
+    if (ADBUS_TRACE_MATCH) {
+        adbusI_log("match examined %d", (int) examined);
     }
 
-    return 0;
+    return ret;
 }
+// ----------------------------------------------------------------------------
 
+/** Gets statistics on match dispatch
+ *  \relates adbus_Connection
+ *
+ *  \param[out] messages  Number of messages run through the match lookup.
+ *  \param[out] examined  Total number of matches that were checked against
+ *  those messages.
+ *
+ *  Matches are indexed on the path and on the interface and member, so
+ *  normally only a few matches are checked for each message. Matches that
+ *  specify neither a path nor a member are checked against every message.
+ */
+void adbus_conn_matchstats(
+        adbus_Connection*   c,
+        size_t*             messages,
+        size_t*             examined)
+{
+    if (messages)
+        *messages = c->matchMessages;
+    if (examined)
+        *examined = c->matchesExamined;
+}
 
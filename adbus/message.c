@@ -79,6 +79,28 @@
  *  adbus_conn_send(msg, connection);
  *  \endcode
  *
+ *  The encoded header fields are kept from one build to the next as long as
+ *  they (and the argument signature) don't change. To repeatedly send the
+ *  same call only reset the arguments with adbus_msg_resetargs() so that
+ *  each build only has to fill out the serial, the body length and the
+ *  arguments:
+ *
+ *  \code
+ *  adbus_msg_reset(msg);
+ *  adbus_msg_settype(msg, ADBUS_MSG_METHOD);
+ *  adbus_msg_setdestination(msg, "com.example.Service", -1);
+ *  adbus_msg_setpath(msg, "/", -1);
+ *  adbus_msg_setmember(msg, "Ping", -1);
+ *
+ *  for (int i = 0; i < 1000; i++) {
+ *      adbus_msg_resetargs(msg);
+ *      adbus_msg_setflags(msg, ADBUS_MSG_NO_REPLY);
+ *      adbus_msg_setsig(msg, "i", 1);
+ *      adbus_msg_i32(msg, i);
+ *      adbus_msg_send(msg, connection);
+ *  }
+ *  \endcode
+ *
  *  To clone and send the message on another thread:
  *
  *  \code
@@ -133,6 +155,7 @@ void adbus_msg_free(adbus_MsgFactory* m)
     ds_free(&m->error);
     ds_free(&m->destination);
     ds_free(&m->sender);
+    ds_free(&m->headerSig);
     free(m);
 }
 
@@ -156,6 +179,24 @@ void adbus_msg_reset(adbus_MsgFactory* m)
     ds_clear(&m->error);
     ds_clear(&m->destination);
     ds_clear(&m->sender);
+    m->headerSize       = 0;
+}
+
+// ----------------------------------------------------------------------------
+
+/** Resets the arguments, serial and flags but keeps the header fields.
+ *  \relates adbus_MsgFactory
+ *
+ *  This should be used when sending the same message repeatedly with
+ *  different arguments, as the header fields do not need to be encoded again
+ *  if they don't change.
+ */
+void adbus_msg_resetargs(adbus_MsgFactory* m)
+{
+    m->flags            = 0;
+    m->serial           = -1;
+    m->argumentOffset   = 0;
+    adbus_buf_reset(m->argbuf);
 }
 
 // ----------------------------------------------------------------------------
@@ -238,8 +279,6 @@ static void AppendUInt32(adbus_MsgFactory* m, adbus_BufArray* a, uint8_t code, u
  */
 int adbus_msg_build(adbus_MsgFactory* m, adbus_Message* msg)
 {
-    adbus_buf_reset(m->buf);
-
     // Check that we have required fields
     CHECK(m->serial >= 0);
     if (m->messageType == ADBUS_MSG_METHOD) {
@@ -259,33 +298,53 @@ int adbus_msg_build(adbus_MsgFactory* m, adbus_Message* msg)
         return -1;
     }
 
-    struct adbusI_Header header;
-    header.endianness   = adbusI_nativeEndianness();
-    header.type         = (uint8_t) m->messageType;
-    header.flags        = (uint8_t) m->flags;
-    header.version      = adbusI_majorProtocolVersion;
-    header.length       = adbus_buf_size(m->argbuf);
-    header.serial       = (uint32_t) m->serial;
-    adbus_buf_append(m->buf, (const char*) &header, sizeof(struct adbusI_Header));
-
-    adbus_BufArray a;
-    adbus_buf_appendsig(m->buf, "a(yv)", 5);
-    adbus_buf_beginarray(m->buf, &a);
-    AppendString(m, &a, HEADER_INTERFACE, &m->interface);
-    AppendString(m, &a, HEADER_MEMBER, &m->member);
-    AppendString(m, &a, HEADER_ERROR_NAME, &m->error);
-    AppendString(m, &a, HEADER_DESTINATION, &m->destination);
-    AppendString(m, &a, HEADER_SENDER, &m->sender);
-    AppendObjectPath(m, &a, HEADER_OBJECT_PATH, &m->path);
-    if (m->hasReplySerial)
-        AppendUInt32(m, &a, HEADER_REPLY_SERIAL, m->replySerial);
-    if (adbus_buf_size(m->argbuf) > 0)
-        AppendSignature(m, &a, HEADER_SIGNATURE, adbus_buf_sig(m->argbuf, NULL));
-    adbus_buf_endarray(m->buf, &a);
+    adbus_buf_end(m->argbuf);
 
-    adbus_buf_align(m->buf, 8);
+    // The signature header field is only added if there are arguments
+    const char* sig = adbus_buf_size(m->argbuf) > 0 ? adbus_buf_sig(m->argbuf, NULL) : "";
+
+    if (m->headerSize > 0 && ds_cmp(&m->headerSig, sig) == 0) {
+        // Header fields are unchanged since the last build so we only need
+        // to drop the old arguments
+        adbus_buf_remove(m->buf, m->headerSize, adbus_buf_size(m->buf) - m->headerSize);
+
+    } else {
+        adbus_buf_reset(m->buf);
+
+        // The fixed part of the header is filled out below
+        struct adbusI_Header header;
+        ZERO(&header);
+        adbus_buf_append(m->buf, (const char*) &header, sizeof(struct adbusI_Header));
+
+        adbus_BufArray a;
+        adbus_buf_appendsig(m->buf, "a(yv)", 5);
+        adbus_buf_beginarray(m->buf, &a);
+        AppendString(m, &a, HEADER_INTERFACE, &m->interface);
+        AppendString(m, &a, HEADER_MEMBER, &m->member);
+        AppendString(m, &a, HEADER_ERROR_NAME, &m->error);
+        AppendString(m, &a, HEADER_DESTINATION, &m->destination);
+        AppendString(m, &a, HEADER_SENDER, &m->sender);
+        AppendObjectPath(m, &a, HEADER_OBJECT_PATH, &m->path);
+        if (m->hasReplySerial)
+            AppendUInt32(m, &a, HEADER_REPLY_SERIAL, m->replySerial);
+        if (*sig)
+            AppendSignature(m, &a, HEADER_SIGNATURE, sig);
+        adbus_buf_endarray(m->buf, &a);
+
+        adbus_buf_align(m->buf, 8);
+
+        m->headerSize = adbus_buf_size(m->buf);
+        ds_set(&m->headerSig, sig);
+    }
+
+    struct adbusI_Header* header = (struct adbusI_Header*) adbus_buf_data(m->buf);
+    header->endianness  = adbusI_nativeEndianness();
+    header->type        = (uint8_t) m->messageType;
+    header->flags       = (uint8_t) m->flags;
+    header->version     = adbusI_majorProtocolVersion;
+    header->length      = adbus_buf_size(m->argbuf);
+    header->serial      = (uint32_t) m->serial;
 
-    adbus_buf_end(m->argbuf);
     if (adbus_buf_size(m->argbuf) > 0)
       adbus_buf_append(m->buf, adbus_buf_data(m->argbuf), adbus_buf_size(m->argbuf));
 
@@ -552,20 +611,36 @@ void adbus_msg_setflags(adbus_MsgFactory* m, int flags)
  */
 void adbus_msg_setreply(adbus_MsgFactory* m, uint32_t reply)
 {
+    if (!m->hasReplySerial || m->replySerial != reply) {
+        m->headerSize = 0;
+    }
     m->replySerial = reply;
     m->hasReplySerial = 1;
 }
 
 // ----------------------------------------------------------------------------
 
+// Only invalidates the cached header if the field actually changes, so that
+// setting the same fields for each call still reuses the header.
+static void SetField(adbus_MsgFactory* m, d_String* field, const char* str, int size)
+{
+    if (size < 0)
+        size = strlen(str);
+
+    if (ds_size(field) != (size_t) size || memcmp(ds_cstr(field), str, size) != 0) {
+        ds_set_n(field, str, size);
+        m->headerSize = 0;
+    }
+}
+
+// ----------------------------------------------------------------------------
+
 /** Sets the message object path field
  *  \relates adbus_MsgFactory
  */
 void adbus_msg_setpath(adbus_MsgFactory* m, const char* path, int size)
 {
-    if (size < 0)
-        size = strlen(path);
-    ds_set_n(&m->path, path, size);
+    SetField(m, &m->path, path, size);
 }
 
 // ----------------------------------------------------------------------------
@@ -575,9 +650,7 @@ void adbus_msg_setpath(adbus_MsgFactory* m, const char* path, int size)
  */
 void adbus_msg_setinterface(adbus_MsgFactory* m, const char* interface, int size)
 {
-    if (size < 0)
-        size = strlen(interface);
-    ds_set_n(&m->interface, interface, size);
+    SetField(m, &m->interface, interface, size);
 }
 
 // ----------------------------------------------------------------------------
@@ -587,9 +660,7 @@ void adbus_msg_setinterface(adbus_MsgFactory* m, const char* interface, int size
  */
 void adbus_msg_setmember(adbus_MsgFactory* m, const char* member, int size)
 {
-    if (size < 0)
-        size = strlen(member);
-    ds_set_n(&m->member, member, size);
+    SetField(m, &m->member, member, size);
 }
 
 // ----------------------------------------------------------------------------
@@ -599,9 +670,7 @@ void adbus_msg_setmember(adbus_MsgFactory* m, const char* member, int size)
  */
 void adbus_msg_seterror(adbus_MsgFactory* m, const char* error, int size)
 {
-    if (size < 0)
-        size = strlen(error);
-    ds_set_n(&m->error, error, size);
+    SetField(m, &m->error, error, size);
 }
 
 // ----------------------------------------------------------------------------
@@ -611,9 +680,7 @@ void adbus_msg_seterror(adbus_MsgFactory* m, const char* error, int size)
  */
 void adbus_msg_setdestination(adbus_MsgFactory* m, const char* destination, int size)
 {
-    if (size < 0)
-        size = strlen(destination);
-    ds_set_n(&m->destination, destination, size);
+    SetField(m, &m->destination, destination, size);
 }
 
 // ----------------------------------------------------------------------------
@@ -623,9 +690,7 @@ void adbus_msg_setdestination(adbus_MsgFactory* m, const char* destination, int
  */
 void adbus_msg_setsender(adbus_MsgFactory* m, const char* sender, int size)
 {
-    if (size < 0)
-        size = strlen(sender);
-    ds_set_n(&m->sender, sender, size);
+    SetField(m, &m->sender, sender, size);
 }
 
 // ----------------------------------------------------------------------------
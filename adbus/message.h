@@ -49,6 +49,11 @@ struct adbus_MsgFactory
     d_String              error;
     d_String              destination;
     d_String              sender;
+
+    // Size of the encoded header at the start of buf from the last build or
+    // 0 if any of the header fields have changed since
+    size_t                headerSize;
+    d_String              headerSig;
 };
 
 
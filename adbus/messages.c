@@ -128,6 +128,32 @@ int adbus_dispatch(adbus_MsgCallback callback, adbus_CbData* d)
 
 // ----------------------------------------------------------------------------
 
+// The error message is formatted into the connection's arena if we have one
+static void VError(
+        adbus_CbData*   d,
+        const char*     errorName,
+        const char*     errorMsgFormat,
+        va_list         ap)
+{
+    if (d->connection) {
+        adbusI_Arena* a = &d->connection->arena;
+        size_t sz;
+        adbusI_arena_begin(a);
+        char* msg = adbusI_arena_vprintf(a, &sz, errorMsgFormat, ap);
+        adbus_error(d, errorName, -1, msg, (int) sz);
+        adbusI_arena_end(a);
+
+    } else {
+        d_String msg;
+        ZERO(&msg);
+        ds_cat_vf(&msg, errorMsgFormat, ap);
+        adbus_error(d, errorName, -1, ds_cstr(&msg), ds_size(&msg));
+        ds_free(&msg);
+    }
+}
+
+// ----------------------------------------------------------------------------
+
 #ifdef _MSC_VER
 #pragma warning(disable:4702) /* unreachable code due to longjmp */
 #endif
@@ -143,17 +169,11 @@ int adbus_errorf_jmp(
         const char*                 errorMsgFormat,
         ...)
 {
-    d_String msg;
-    ZERO(&msg);
     va_list ap;
     va_start(ap, errorMsgFormat);
-    ds_cat_vf(&msg, errorMsgFormat, ap);
+    VError(d, errorName, errorMsgFormat, ap);
     va_end(ap);
 
-    adbus_error(d, errorName, -1, ds_cstr(&msg), ds_size(&msg));
-
-    ds_free(&msg);
-
     longjmp(d->jmpbuf, ADBUSI_ERROR);
     return 0;
 }
@@ -189,17 +209,11 @@ int adbus_errorf(
         const char*                 errorMsgFormat,
         ...)
 {
-    d_String msg;
-    ZERO(&msg);
     va_list ap;
     va_start(ap, errorMsgFormat);
-    ds_cat_vf(&msg, errorMsgFormat, ap);
+    VError(d, errorName, errorMsgFormat, ap);
     va_end(ap);
 
-    adbus_error(d, errorName, -1, ds_cstr(&msg), ds_size(&msg));
-
-    ds_free(&msg);
-
     return 0;
 }
 
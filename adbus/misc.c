@@ -33,6 +33,12 @@
 #include <stdio.h>
 #include <malloc.h>
 
+#ifdef _WIN32
+#   include <windows.h>
+#else
+#   include <time.h>
+#endif
+
 
 
 
@@ -72,6 +78,23 @@ void adbusI_dolog(const char* format, ...)
 #   define alloca _alloca
 #endif
 
+// ----------------------------------------------------------------------------
+
+// Monotonic clock in milliseconds used for reply timeouts
+int64_t adbusI_clock(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (int64_t) (count.QuadPart / (freq.QuadPart / 1000));
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
+
 void adbusI_addheader(d_String* str, const char* format, ...)
 {
     size_t begin = ds_size(str);
@@ -147,177 +170,6 @@ const uint8_t adbusI_majorProtocolVersion = 1;
 
 // ----------------------------------------------------------------------------
 
-adbus_Bool adbusI_isValidObjectPath(const char* str, size_t len)
-{
-    if (!str || len == 0)
-        return 0;
-    if (str[0] != '/')
-        return 0;
-    if (len > 1 && str[len - 1] == '/')
-        return 0;
-
-    // Now we check for consecutive '/' and that
-    // the path components only use [A-Z][a-z][0-9]_
-    const char* slash = str;
-    const char* cur = str;
-    while (++cur < str + len)
-    {
-        if (*cur == '/')
-        {
-            if (cur - slash == 1)
-                return 0;
-            slash = cur;
-            continue;
-        }
-        else if ( ('a' <= *cur && *cur <= 'z')
-                || ('A' <= *cur && *cur <= 'Z')
-                || ('0' <= *cur && *cur <= '9')
-                || *cur == '_')
-        {
-            continue;
-        }
-        else
-        {
-            return 0;
-        }
-    }
-    return 1;
-}
-
-// ----------------------------------------------------------------------------
-
-adbus_Bool adbusI_isValidInterfaceName(const char* str, size_t len)
-{
-    if (!str || len == 0 || len > 255)
-        return 0;
-
-    // Must not begin with a digit
-    if (!(  ('a' <= str[0] && str[0] <= 'z')
-                || ('A' <= str[0] && str[0] <= 'Z')
-                || (str[0] == '_')))
-    {
-        return 0;
-    }
-
-    // Now we check for consecutive '.' and that
-    // the components only use [A-Z][a-z][0-9]_
-    const char* dot = str - 1;
-    const char* cur = str;
-    while (++cur < str + len)
-    {
-        if (*cur == '.')
-        {
-            if (cur - dot == 1)
-                return 0;
-            dot = cur;
-            continue;
-        }
-        else if ( ('a' <= *cur && *cur <= 'z')
-                || ('A' <= *cur && *cur <= 'Z')
-                || ('0' <= *cur && *cur <= '9')
-                || (*cur == '_'))
-        {
-            continue;
-        }
-        else
-        {
-            return 0;
-        }
-    }
-    // Interface names must include at least one '.'
-    if (dot == str - 1)
-        return 0;
-
-    return 1;
-}
-
-// ----------------------------------------------------------------------------
-
-adbus_Bool adbusI_isValidBusName(const char* str, size_t len)
-{
-    if (!str || len == 0 || len > 255)
-        return 0;
-
-    // Bus name must either begin with : or not a digit
-    if (!(  (str[0] == ':')
-                || ('a' <= str[0] && str[0] <= 'z')
-                || ('A' <= str[0] && str[0] <= 'Z')
-                || (str[0] == '_')
-                || (str[0] == '-')))
-    {
-        return 0;
-    }
-
-    // Now we check for consecutive '.' and that
-    // the components only use [A-Z][a-z][0-9]_
-    const char* dot = str[0] == ':' ? str : str - 1;
-    const char* cur = str;
-    while (++cur < str + len)
-    {
-        if (*cur == '.')
-        {
-            if (cur - dot == 1)
-                return 0;
-            dot = cur;
-            continue;
-        }
-        else if ( ('a' <= *cur && *cur <= 'z')
-                || ('A' <= *cur && *cur <= 'Z')
-                || ('0' <= *cur && *cur <= '9')
-                || (*cur == '_')
-                || (*cur == '-'))
-        {
-            continue;
-        }
-        else
-        {
-            return 0;
-        }
-    }
-    // Bus names must include at least one '.'
-    if (dot == str - 1)
-        return 0;
-
-    return 1;
-}
-
-// ----------------------------------------------------------------------------
-
-adbus_Bool adbusI_isValidMemberName(const char* str, size_t len)
-{
-    if (!str || len == 0 || len > 255)
-        return 0;
-
-    // Must not begin with a digit
-    if (!(   ('a' <= str[0] && str[0] <= 'z')
-          || ('A' <= str[0] && str[0] <= 'Z')
-          || (str[0] == '_')))
-    {
-        return 0;
-    }
-
-    // We now check that we only use [A-Z][a-z][0-9]_
-    const char* cur = str;
-    while (++cur < str + len)
-    {
-        if ( ('a' <= *cur && *cur <= 'z')
-          || ('A' <= *cur && *cur <= 'Z')
-          || ('0' <= *cur && *cur <= '9')
-          || (*cur == '_'))
-        {
-            continue;
-        }
-        else
-        {
-            return 0;
-        }
-    }
-
-    return 1;
-}
-
-// ----------------------------------------------------------------------------
-
 adbus_Bool adbusI_hasNullByte(const char* str, size_t len)
 {
     return memchr(str, '\0', len) != NULL;
@@ -325,102 +177,6 @@ adbus_Bool adbusI_hasNullByte(const char* str, size_t len)
 
 // ----------------------------------------------------------------------------
 
-#if 0
-adbus_Bool adbusI_isValidUtf8(const char* str, size_t len)
-{
-    if (!str)
-        return 1;
-    const char* s = str;
-    const char* end = str + len;
-    while (s < end)
-    {
-        if (s[0] < 0x80)
-        {
-            // 1 byte sequence (US-ASCII)
-            s += 1;
-        }
-        else if (s[0] < 0xC0)
-        {
-            // Multi-byte data without start
-            return 0;
-        }
-        else if (s[0] < 0xE0)
-        {
-            // 2 byte sequence
-            if (end - s < 2)
-                return 0;
-
-            // Check the continuation bytes
-            if (!(0x80 <= s[1] && s[1] < 0xC0))
-                return 0;
-
-            // Check for overlong encoding
-            // 0x80 -> 0xC2 0x80
-            if (s[0] < 0xC2)
-                return 0;
-
-            s += 2;
-        }
-        else if (s[0] < 0xF0)
-        {
-            // 3 byte sequence
-            if (end - s < 3)
-                return 0;
-
-            // Check the continuation bytes
-            if (!(  0x80 <= s[1] && s[1] < 0xC0
-                        && 0x80 <= s[2] && s[2] < 0xC0))
-                return 0;
-
-            // Check for overlong encoding
-            // 0x08 00 -> 0xE0 A0 90
-            if (s[0] == 0xE0 && s[1] < 0xA0)
-                return 0;
-
-            // Code points [0xD800, 0xE000) are invalid
-            // (UTF16 surrogate characters)
-            // 0xD8 00 -> 0xED A0 80
-            // 0xDF FF -> 0xED BF BF
-            // 0xE0 00 -> 0xEE 80 80
-            if (s[0] == 0xED && s[1] >= 0xA0)
-                return 0;
-
-            s += 3;
-        }
-        else if (s[0] < 0xF5)
-        {
-            // 4 byte sequence
-            if (end - s < 4)
-                return 0;
-
-            // Check the continuation bytes
-            if (!(  0x80 <= s[1] && s[1] < 0xC0
-                        && 0x80 <= s[2] && s[2] < 0xC0
-                        && 0x80 <= s[3] && s[3] < 0xC0))
-                return 0;
-
-            // Check for overlong encoding
-            // 0x01 00 00 -> 0xF0 90 80 80
-            if (s[0] == 0xF0 && s[1] < 0x90)
-                return 0;
-
-            s += 4;
-        }
-        else
-        {
-            // 4 byte above 0x10FFFF, 5 byte, and 6 byte sequences
-            // restricted by RFC 3639
-            // 0xFE-0xFF invalid
-            return 0;
-        }
-    }
-
-    return s == end ? 1 : 0;
-}
-#endif
-
-// ----------------------------------------------------------------------------
-
 const char* adbus_nextarg(const char* sig)
 {
     switch(*sig)
@@ -606,6 +362,21 @@ void adbusI_matchString(d_String* s, const adbus_Match* m)
 
 // ----------------------------------------------------------------------------
 
+#ifdef ADBUSI_HAVE_AVX2
+adbus_Bool adbusI_cpuHasAVX2(void)
+{
+    // Threads racing to set this will all set the same value
+    static int hasAVX2 = -1;
+    if (hasAVX2 < 0) {
+        __builtin_cpu_init();
+        hasAVX2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+    return hasAVX2;
+}
+#endif
+
+// ----------------------------------------------------------------------------
+
 int adbus_error_argument(adbus_CbData* d)
 {
     if (d->msg->interface) {
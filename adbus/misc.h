@@ -37,7 +37,9 @@
 
 #include "dmem/hash.h"
 #include "dmem/string.h"
+#include "dmem/vector.h"
 
+#include <stdarg.h>
 #include <string.h>
 
 #if defined(__GNUC__) && ((__GNUC__*100 + __GNUC_MINOR__) >= 302) && defined(__ELF__)
@@ -112,6 +114,9 @@
   ADBUS_INLINE long adbus_InterlockedDecrement(long volatile* addend)
   { return __sync_add_and_fetch(addend, -1); }
 
+  ADBUS_INLINE void* adbus_InterlockedCompareExchangePointer(void* volatile* dest, void* exchange, void* comparand)
+  { return __sync_val_compare_and_swap(dest, comparand, exchange); }
+
 #elif defined _MSC_VER && _MSC_VER < 1300 && defined _M_IX86
 #error Apparently MSVC++ 6.0 generates rubbish when optimizations are on
 
@@ -120,9 +125,11 @@
 extern "C" {
     long __cdecl _InterlockedIncrement(volatile long *);
     long __cdecl _InterlockedDecrement(volatile long *);
+    void* __cdecl _InterlockedCompareExchangePointer(void* volatile*, void*, void*);
 }
 #  pragma intrinsic (_InterlockedIncrement)
 #  pragma intrinsic (_InterlockedDecrement)
+#  pragma intrinsic (_InterlockedCompareExchangePointer)
 
 ADBUS_INLINE long adbus_InterlockedIncrement(long volatile* addend)
 { return _InterlockedIncrement(addend); }
@@ -130,6 +137,9 @@ ADBUS_INLINE long adbus_InterlockedIncrement(long volatile* addend)
 ADBUS_INLINE long adbus_InterlockedDecrement(long volatile* addend)
 { return _InterlockedDecrement(addend); }
 
+ADBUS_INLINE void* adbus_InterlockedCompareExchangePointer(void* volatile* dest, void* exchange, void* comparand)
+{ return _InterlockedCompareExchangePointer(dest, exchange, comparand); }
+
 #elif defined _MSC_VER && defined _WIN32 && defined _WIN32_WCE
 
 #if _WIN32_WCE < 0x600 && defined(_X86_)
@@ -167,6 +177,9 @@ ADBUS_INLINE long adbus_InterlockedIncrement(long volatile* addend)
 ADBUS_INLINE long adbus_InterlockedDecrement(long volatile* addend)
 { return _InterlockedDecrement(addend); }
 
+ADBUS_INLINE void* adbus_InterlockedCompareExchangePointer(void* volatile* dest, void* exchange, void* comparand)
+{ return InterlockedCompareExchangePointer(dest, exchange, comparand); }
+
 #endif
 
 #endif
@@ -174,6 +187,8 @@ ADBUS_INLINE long adbus_InterlockedDecrement(long volatile* addend)
 // ----------------------------------------------------------------------------
 
 ADBUSI_FUNC void adbusI_addheader(d_String* str, const char* format, ...);
+ADBUSI_FUNC int64_t adbusI_clock(void);
+ADBUSI_FUNC adbus_ssize_t adbusI_sock_recv(adbus_Socket sock, adbus_Buffer* buf, int timeoutms);
 ADBUSI_FUNC void adbusI_dolog(const char* format, ...);
 ADBUSI_FUNC void adbusI_klog(d_String* str);
 ADBUSI_FUNC int  adbusI_log_enabled(void);
@@ -186,6 +201,83 @@ ADBUSI_FUNC int  adbusI_log_enabled(void);
 
 // ----------------------------------------------------------------------------
 
+// Outbound message queue used by adbus_Connection and adbus_Remote to batch
+// up messages so they can be written out with a single vectored send. The
+// queue is disabled when threshold is 0.
+
+DVECTOR_INIT(SharedMsg, adbus_SharedMsg*);
+
+typedef struct adbusI_SendQueue
+{
+    d_Vector(SharedMsg)     msgs;
+    size_t                  size;
+    size_t                  threshold;
+} adbusI_SendQueue;
+
+ADBUSI_FUNC int  adbusI_queue_push(adbusI_SendQueue* q, adbus_Message* m, adbus_SendMsgsCallback cb, void* user);
+ADBUSI_FUNC int  adbusI_queue_flush(adbusI_SendQueue* q, adbus_SendMsgsCallback cb, void* user);
+ADBUSI_FUNC void adbusI_queue_free(adbusI_SendQueue* q);
+
+// Lock free multi producer single consumer queue of messages. Producers push
+// onto the front of an intrusive list with a compare and swap. The consumer
+// takes the entire list in one go and reverses it back into send order when
+// moving it onto a SendQueue. Push returns true if the list was previously
+// empty, ie if the consumer needs to be woken up.
+
+typedef struct adbusI_QueuedMsg
+{
+    struct adbusI_QueuedMsg*    next;
+    adbus_SharedMsg*            msg;
+} adbusI_QueuedMsg;
+
+ADBUSI_FUNC adbus_Bool adbusI_mpsc_push(adbusI_QueuedMsg* volatile* head, adbus_Message* m);
+ADBUSI_FUNC void adbusI_mpsc_take(adbusI_QueuedMsg* volatile* head, adbusI_SendQueue* q);
+
+// ----------------------------------------------------------------------------
+
+// Bump allocator for per-message scratch space (argument arrays, error
+// strings) used by adbus_Connection and adbus_Server. Allocations are valid
+// until the outermost adbusI_arena_end. When disabled each allocation is a
+// separate malloc, which is still freed by adbusI_arena_end. mallocs counts
+// every heap allocation made by the arena.
+
+struct adbusI_ArenaBlock;
+
+typedef struct adbusI_Arena
+{
+    adbus_Bool                  enabled;
+    int                         depth;
+    char*                       data;
+    size_t                      used;
+    size_t                      size;
+    struct adbusI_ArenaBlock*   blocks;
+    size_t                      blocksSize;
+    size_t                      mallocs;
+} adbusI_Arena;
+
+ADBUSI_FUNC void  adbusI_arena_enable(adbusI_Arena* a, adbus_Bool enable);
+ADBUSI_FUNC void  adbusI_arena_begin(adbusI_Arena* a);
+ADBUSI_FUNC void  adbusI_arena_end(adbusI_Arena* a);
+ADBUSI_FUNC void* adbusI_arena_alloc(adbusI_Arena* a, size_t size);
+ADBUSI_FUNC char* adbusI_arena_vprintf(adbusI_Arena* a, size_t* size, const char* format, va_list ap);
+ADBUSI_FUNC void  adbusI_arena_free(adbusI_Arena* a);
+
+ADBUSI_FUNC int adbusI_parseargs(adbus_Message* m, adbusI_Arena* a);
+
+// ----------------------------------------------------------------------------
+
+// Makes room for a message of the given size at the start of the buffer
+// data, with the data 8 byte aligned, so that the rest of a partially
+// received message is read straight into place.
+ADBUSI_FUNC void adbusI_buf_reservemsg(adbus_Buffer* b, size_t size);
+
+// Appends size bytes of uninitialised space to the end of the buffer and
+// returns a pointer to it. The space is part of the buffer's data (unlike
+// adbus_buf_recvbuf) and must be filled in by the caller.
+ADBUSI_FUNC char* adbusI_buf_push(adbus_Buffer* b, size_t size);
+
+// ----------------------------------------------------------------------------
+
 ADBUSI_DATA const uint8_t adbusI_majorProtocolVersion;
 
 ADBUSI_FUNC char adbusI_nativeEndianness(void);
@@ -281,6 +373,25 @@ enum
 
 // ----------------------------------------------------------------------------
 
+// SSE2 kernels are used if the compiler targets SSE2. AVX2 kernels are
+// compiled using the target attribute and are chosen at runtime if the CPU
+// supports them.
+#if defined __SSE2__ || defined _M_X64 || (defined _M_IX86_FP && _M_IX86_FP >= 2)
+#   define ADBUSI_HAVE_SSE2
+#endif
+
+#if defined ADBUSI_HAVE_SSE2 && (defined __x86_64__ || defined __i386__) \
+    && (defined __clang__ || (defined __GNUC__ && __GNUC__ >= 5))
+#   define ADBUSI_HAVE_AVX2
+#endif
+
+#ifdef ADBUSI_HAVE_AVX2
+// Returns whether the CPU supports AVX2. The check is only done once.
+ADBUSI_FUNC adbus_Bool adbusI_cpuHasAVX2(void);
+#endif
+
+// ----------------------------------------------------------------------------
+
 #define ADBUSI_ALIGN(p,b) ADBUS_ALIGN(p,b)
 
 // where b0 is the lowest byte
@@ -309,6 +420,12 @@ ADBUSI_FUNC adbus_Bool adbusI_isValidBusName(const char* str, size_t len);
 ADBUSI_FUNC adbus_Bool adbusI_isValidMemberName(const char* str, size_t len);
 ADBUSI_FUNC adbus_Bool adbusI_hasNullByte(const char* str, size_t len);
 ADBUSI_FUNC adbus_Bool adbusI_isValidUtf8(const char* str, size_t len);
+ADBUSI_FUNC adbus_Bool adbusI_isValidSignature(const char* str, size_t len);
+
+ADBUSI_FUNC int adbusI_validateValue(adbus_Iterator* i);
+ADBUSI_FUNC int adbusI_validateData(const char* data, size_t size, const char* sig);
+
+ADBUSI_FUNC void adbusI_flipArray(char* data, size_t size, int width);
 
 // ----------------------------------------------------------------------------
 
@@ -181,6 +181,46 @@
  *  Size of arguments field.
  */
 
+/** \var adbus_Message::shared
+ *  Shared buffer holding the message data or NULL.
+ *
+ *  This is set when the message data is already held in a ref counted
+ *  buffer (eg messages forwarded by adbus_Server) so that adbus_msg_share()
+ *  can take a ref instead of copying.
+ */
+
+/** \struct adbus_SharedMsg
+ *
+ *  \brief Ref counted immutable copy of a message's data
+ *
+ *  This is used to send the same message to multiple destinations without
+ *  copying the data for each destination. A send callback that needs to hold
+ *  onto the message after it returns (eg to queue it until the socket becomes
+ *  writable) should call adbus_msg_share() and then adbus_smsg_deref() once
+ *  the data has been written out.
+ *
+ *  For example:
+ *  \code
+ *  static adbus_ssize_t SendMsg(void* d, adbus_Message* m)
+ *  {
+ *      struct Remote* r = (struct Remote*) d;
+ *      adbus_SharedMsg* s = adbus_msg_share(m);
+ *      QueueForWrite(r, s); // calls adbus_smsg_deref when written
+ *      return m->size;
+ *  }
+ *  \endcode
+ *
+ *  \warning The data must not be modified.
+ */
+
+/** \var adbus_SharedMsg::data
+ *  Beginning of message data.
+ */
+
+/** \var adbus_SharedMsg::size
+ *  Size of message data.
+ */
+
 /* -------------------------------------------------------------------------- */
 // Manually unpack even for native endianness since value not be 4 byte
 // aligned
@@ -220,6 +260,185 @@ size_t adbus_parse_size(const char* data, size_t size)
     return ADBUSI_ALIGN(hsize, 8) + Get32(h->endianness, &h->length);
 }
 
+/* -------------------------------------------------------------------------- */
+/* The header fields are decoded directly rather than through the generic
+ * iterator. The header is an a(yv) where the fields we care about always
+ * have a single character signature, so each field is decoded as a (code,
+ * signature, value) tuple using the table below to find the required
+ * signature and where the value goes in the adbus_Message. Unknown fields are
+ * skipped using the generic iterator.
+ *
+ * The validation is the same as iterating through the header using
+ * adbus_iter_beginarray() etc:
+ * - Every field must be within the message data.
+ * - Known fields must have the right signature.
+ * - Strings must be null terminated with no embedded nulls.
+ *
+ * The contents of the known fields are then validated in adbus_parse() once
+ * we know which are present.
+ */
+
+struct HeaderField
+{
+    char    type;
+    size_t  value;
+    size_t  size;
+};
+
+#define FIELD(type, value, size) \
+    {type, offsetof(adbus_Message, value), offsetof(adbus_Message, size)}
+
+static const struct HeaderField sHeaderFields[] = {
+    {'\0', 0, 0},                                   // HEADER_INVALID
+    FIELD('o', path, pathSize),                     // HEADER_OBJECT_PATH
+    FIELD('s', interface, interfaceSize),           // HEADER_INTERFACE
+    FIELD('s', member, memberSize),                 // HEADER_MEMBER
+    FIELD('s', error, errorSize),                   // HEADER_ERROR_NAME
+    {'u', offsetof(adbus_Message, replySerial), 0}, // HEADER_REPLY_SERIAL
+    FIELD('s', destination, destinationSize),       // HEADER_DESTINATION
+    FIELD('s', sender, senderSize),                 // HEADER_SENDER
+    FIELD('g', signature, signatureSize),           // HEADER_SIGNATURE
+};
+
+#define HEADER_FIELD_NUM (sizeof(sHeaderFields) / sizeof(sHeaderFields[0]))
+
+// Reads an aligned uint32_t. Non-native values are flipped in place so the
+// data is left in native endianness.
+ADBUS_INLINE uint32_t Read32(char* data, adbus_Bool native)
+{
+    uint32_t* p = (uint32_t*) data;
+    if (!native) {
+        *p =  ((*p & UINT32_C(0xFF000000)) >> 24)
+            | ((*p & UINT32_C(0x00FF0000)) >> 8)
+            | ((*p & UINT32_C(0x0000FF00)) << 8)
+            | ((*p & UINT32_C(0x000000FF)) << 24);
+    }
+    return *p;
+}
+
+// Checks that there are strsz bytes of string followed by a null at off
+ADBUS_INLINE int CheckString(const char* data, size_t size, size_t off, size_t strsz)
+{
+    if (strsz >= size - off)
+        return -1;
+
+    const char* str = data + off;
+    if (str[strsz] != '\0' || memchr(str, '\0', strsz) != NULL)
+        return -1;
+
+    return 0;
+}
+
+// This is inlined with a constant native argument so that we get separate
+// native and non-native versions
+ADBUS_INLINE int ParseHeader(adbus_Message* m, char* data, size_t size, adbus_Bool native)
+{
+    adbusI_ExtendedHeader* h = (adbusI_ExtendedHeader*) data;
+    Read32((char*) &h->length, native);
+    Read32((char*) &h->serial, native);
+
+    uint32_t fieldsz = Read32((char*) &h->headerFieldLength, native);
+    if (fieldsz > ADBUS_MAXIMUM_ARRAY_LENGTH)
+        return -1;
+
+    size_t off = sizeof(adbusI_ExtendedHeader);
+    size_t end = off + fieldsz;
+
+    while (off < end) {
+        // Each field is 8 byte aligned and is at least a code, signature
+        // length, signature character, and signature null.
+        off = ADBUSI_ALIGN(off, 8);
+        if (off > size || size - off < 4)
+            return -1;
+
+        uint8_t code = (uint8_t) data[off];
+        if (code >= HEADER_FIELD_NUM) {
+            // Unknown field - skip the variant
+            off++;
+            if (!native) {
+                char* vdata = data + off;
+                size_t vsize = size - off;
+                const char* vsig = "v";
+                if (adbus_flip_value(&vdata, &vsize, &vsig))
+                    return -1;
+            }
+
+            adbus_Iterator i = {data + off, size - off, "v"};
+            if (adbusI_validateValue(&i))
+                return -1;
+
+            off = i.data - data;
+            continue;
+        }
+
+        const struct HeaderField* f = &sHeaderFields[code];
+        if (    code == HEADER_INVALID
+            ||  data[off + 1] != 1
+            ||  data[off + 2] != f->type
+            ||  data[off + 3] != '\0')
+        {
+            return -1;
+        }
+
+        off += 4;
+        char* value = (char*) m + f->value;
+
+        switch (f->type) {
+        case 's':
+        case 'o':
+            {
+                off = ADBUSI_ALIGN(off, 4);
+                if (off > size || size - off < 4)
+                    return -1;
+
+                uint32_t strsz = Read32(data + off, native);
+                off += 4;
+
+                if (CheckString(data, size, off, strsz))
+                    return -1;
+
+                *(const char**) value = data + off;
+                *(size_t*) ((char*) m + f->size) = strsz;
+                off += strsz + 1;
+            }
+            break;
+
+        case 'g':
+            {
+                if (off >= size)
+                    return -1;
+
+                uint8_t sigsz = (uint8_t) data[off++];
+                if (CheckString(data, size, off, sigsz))
+                    return -1;
+
+                *(const char**) value = data + off;
+                *(size_t*) ((char*) m + f->size) = sigsz;
+                off += sigsz + 1;
+            }
+            break;
+
+        case 'u':
+            {
+                off = ADBUSI_ALIGN(off, 4);
+                if (off > size || size - off < 4)
+                    return -1;
+
+                Read32(data + off, native);
+                *(const uint32_t**) value = (const uint32_t*) (data + off);
+                off += 4;
+            }
+            break;
+
+        default:
+            assert(0);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
 /** Fills out an adbus_Message by parsing the data.
  *
  *  \relates adbus_Message
@@ -233,6 +452,9 @@ size_t adbus_parse_size(const char* data, size_t size)
  *  the data if it is not native (hence char* instead of const char*). The
  *  pointers in the message structure will point into the passed data.
  *
+ *  The header fields and signature are checked to be well formed. The
+ *  arguments are not validated here.
+ *
  *  Due to the 8 byte alignment the size normally needs to be known
  *  beforehand to copy the data into an 8 byte aligned buffer.
  *  adbus_parse_size() can be used to figure out the message size.
@@ -252,12 +474,17 @@ int adbus_parse(adbus_Message* m, char* data, size_t size)
     else if (h->type > ADBUS_MSG_SIGNAL)
         return 0;
 
-    if (!native && adbus_flip_data(data, size, "yyyyuua(yv)"))
-        return -1;
+    memset(m, 0, sizeof(adbus_Message));
 
-    h->endianness = adbusI_nativeEndianness();
+    if (native) {
+        if (ParseHeader(m, data, size, 1))
+            return -1;
+    } else {
+        h->endianness = adbusI_nativeEndianness();
+        if (ParseHeader(m, data, size, 0))
+            return -1;
+    }
 
-    memset(m, 0, sizeof(adbus_Message));
     m->data     = data;
     m->size     = ADBUSI_ALIGN(h->headerFieldLength + sizeof(adbusI_ExtendedHeader), 8) + h->length;
     m->argsize  = h->length;
@@ -266,106 +493,6 @@ int adbus_parse(adbus_Message* m, char* data, size_t size)
     m->flags    = h->flags;
     m->serial   = h->serial;
 
-    adbus_Iterator i = {
-        data + sizeof(adbusI_Header),
-        size - sizeof(adbusI_Header),
-        "a(yv)"
-    };
-    adbus_IterArray a;
-    if (adbus_iter_beginarray(&i, &a))
-        return -1;
-
-    while (adbus_iter_inarray(&i, &a)) {
-        const uint8_t* code;
-        adbus_IterVariant v;
-        if (    adbus_iter_beginstruct(&i) 
-            ||  adbus_iter_u8(&i, &code)
-            ||  adbus_iter_beginvariant(&i, &v))
-        {
-            return -1;
-        }
-        const char** pstr;
-        size_t* psize;
-        switch (*code) {
-            case HEADER_INVALID:
-                return -1;
-
-            case HEADER_INTERFACE:
-                pstr  = &m->interface;
-                psize = &m->interfaceSize;
-                goto string;
-
-            case HEADER_MEMBER:
-                pstr  = &m->member;
-                psize = &m->memberSize;
-                goto string;
-
-            case HEADER_ERROR_NAME:
-                pstr  = &m->error;
-                psize = &m->errorSize;
-                goto string;
-
-            case HEADER_DESTINATION:
-                pstr  = &m->destination;
-                psize = &m->destinationSize;
-                goto string;
-
-            case HEADER_SENDER:
-                pstr  = &m->sender;
-                psize = &m->senderSize;
-                goto string;
-
-            string:
-                if (    i.sig[0] != 's'
-                    ||  i.sig[1] != '\0'
-                    ||  adbus_iter_string(&i, pstr, psize))
-                {
-                    return -1;
-                }
-                break;
-
-            case HEADER_OBJECT_PATH:
-                if (    i.sig[0] != 'o' 
-                    ||  i.sig[1] != '\0'
-                    ||  adbus_iter_objectpath(&i, &m->path, &m->pathSize))
-                {
-                    return -1;
-                }
-                break;
-
-            case HEADER_SIGNATURE:
-                if (    i.sig[0] != 'g' 
-                    ||  i.sig[1] != '\0'
-                    ||  adbus_iter_signature(&i, &m->signature, NULL))
-                {
-                    return -1;
-                }
-                break;
-
-            case HEADER_REPLY_SERIAL:
-                if (    i.sig[0] != 'u' 
-                    ||  i.sig[1] != '\0'
-                    ||  adbus_iter_u32(&i, &m->replySerial))
-                {
-                    return -1;
-                }
-                break;
-
-            default:
-                if (adbus_iter_value(&i)) {
-                    return -1;
-                }
-                break;
-        }
-
-        if (adbus_iter_endvariant(&i, &v) || adbus_iter_endstruct(&i))
-            return -1;
-
-    }
-
-    if (adbus_iter_endarray(&i, &a))
-        return -1;
-
     /* Check that we have the required fields */
     if (m->type == ADBUS_MSG_METHOD && (!m->path || !m->member)) {
         return -1;
@@ -379,13 +506,29 @@ int adbus_parse(adbus_Message* m, char* data, size_t size)
         return -1;
     }
 
+    /* Check that the fields are well formed */
+    if (m->path && !adbusI_isValidObjectPath(m->path, m->pathSize)) {
+        return -1;
+    } else if (m->interface && !adbusI_isValidInterfaceName(m->interface, m->interfaceSize)) {
+        return -1;
+    } else if (m->member && !adbusI_isValidMemberName(m->member, m->memberSize)) {
+        return -1;
+    } else if (m->error && !adbusI_isValidInterfaceName(m->error, m->errorSize)) {
+        return -1;
+    } else if (m->destination && !adbusI_isValidBusName(m->destination, m->destinationSize)) {
+        return -1;
+    } else if (m->sender && !adbusI_isValidBusName(m->sender, m->senderSize)) {
+        return -1;
+    } else if (m->signature && !adbusI_isValidSignature(m->signature, m->signatureSize)) {
+        return -1;
+    }
+
     if (!native && m->signature && adbus_flip_data((char*) m->argdata, m->argsize, m->signature))
         return -1;
 
     return 0;
 }
 
-DVECTOR_INIT(Argument, adbus_Argument);
 /** Parse the arguments in a message.
  *  
  *  \relates adbus_Message
@@ -401,19 +544,40 @@ DVECTOR_INIT(Argument, adbus_Argument);
  *
  */
 int adbus_parseargs(adbus_Message* m)
+{ return adbusI_parseargs(m, NULL); }
+
+/* Version of adbus_parseargs which allocates the argument array from the
+ * arena if it is not NULL. The arguments are then only valid until the end of
+ * the arena scope.
+ */
+int adbusI_parseargs(adbus_Message* m, adbusI_Arena* a)
 {
     if (m->arguments)
         return 0;
 
-    d_Vector(Argument) args;
-    ZERO(&args);
+    assert(m->signature != NULL);
 
-    adbus_Iterator i = {m->argdata, m->argsize, m->signature};
+    // Count the arguments first so that we only need a single allocation
+    size_t num = 0;
+    const char* sig = m->signature;
+    while (*sig) {
+        sig = adbus_nextarg(sig);
+        if (sig == NULL)
+            return -1;
+        num++;
+    }
 
-    assert(m->signature != NULL);
+    if (num == 0)
+        return 0;
 
-    while (*i.sig) {
-        adbus_Argument* arg = dv_push(Argument, &args, 1);
+    adbus_Argument* args = a
+                         ? (adbus_Argument*) adbusI_arena_alloc(a, num * sizeof(adbus_Argument))
+                         : (adbus_Argument*) malloc(num * sizeof(adbus_Argument));
+
+    adbus_Iterator i = {m->argdata, m->argsize, m->signature};
+
+    for (size_t j = 0; j < num; j++) {
+        adbus_Argument* arg = &args[j];
         arg->value = NULL;
         arg->size  = 0;
 
@@ -430,12 +594,14 @@ int adbus_parseargs(adbus_Message* m)
         }
     }
 
-    m->argumentsSize = dv_size(&args);
-    m->arguments = dv_release(Argument, &args);
+    m->argumentsSize = num;
+    m->arguments = args;
     return 0;
 
 err:
-    dv_free(Argument, &args);
+    if (!a) {
+        free(args);
+    }
     return -1;
 }
 
@@ -446,6 +612,7 @@ void adbus_freeargs(adbus_Message* m)
 {
     if (m) {
         free(m->arguments);
+        m->arguments = NULL;
         m->argumentsSize = 0;
     }
 }
@@ -463,21 +630,30 @@ void adbus_clonedata(adbus_Message* from, adbus_Message* to)
     memcpy(data, from->data, from->size);
     to->data = data;
 
-    ptrdiff_t off = from->data - to->data;
+    ptrdiff_t off = to->data - from->data;
 
-    // Update all data pointers to point into the new data section
-    to->argdata += off;
-    to->signature += off;
-    to->replySerial += off;
-    to->path += off;
-    to->interface += off;
-    to->member += off;
-    to->error += off;
-    to->destination += off;
-    to->sender += off;
+    // Update all data pointers to point into the new data section. The
+    // optional fields are left as NULL.
+#define MOVE(field) if (to->field) to->field += off;
+    MOVE(argdata);
+    MOVE(signature);
+    MOVE(path);
+    MOVE(interface);
+    MOVE(member);
+    MOVE(error);
+    MOVE(destination);
+    MOVE(sender);
+#undef MOVE
+
+    if (to->replySerial)
+        to->replySerial = (const uint32_t*) ((const char*) to->replySerial + off);
+
+    // The copy doesn't hold a ref on the original shared buffer
+    to->shared = NULL;
 
     if (from->arguments) {
         to->arguments = (adbus_Argument*) malloc(sizeof(adbus_Argument) * from->argumentsSize);
+        memcpy(to->arguments, from->arguments, sizeof(adbus_Argument) * from->argumentsSize);
 
         for (size_t i = 0; i < to->argumentsSize; i++) {
             if (to->arguments[i].value) {
@@ -496,3 +672,46 @@ void adbus_freedata(adbus_Message* m)
     }
 }
 
+// ----------------------------------------------------------------------------
+
+/** Gets a ref counted copy of the message data.
+ *  \relates adbus_Message
+ *
+ *  If the message is already backed by a shared buffer this just takes
+ *  another ref, otherwise the data is copied into a new shared buffer.
+ *
+ *  The returned buffer must be freed with adbus_smsg_deref().
+ */
+adbus_SharedMsg* adbus_msg_share(adbus_Message* m)
+{
+    if (m->shared) {
+        assert(m->shared->data == m->data && m->shared->size == m->size);
+        adbus_smsg_ref(m->shared);
+        return m->shared;
+    }
+
+    adbus_SharedMsg* s = NEW(adbus_SharedMsg);
+    s->alloc = (char*) malloc(m->size);
+    memcpy(s->alloc, m->data, m->size);
+    s->data  = s->alloc;
+    s->size  = m->size;
+    s->ref   = 1;
+    return s;
+}
+
+/** Refs a shared message buffer.
+ *  \relates adbus_SharedMsg
+ */
+void adbus_smsg_ref(adbus_SharedMsg* s)
+{ adbus_InterlockedIncrement(&s->ref); }
+
+/** Derefs a shared message buffer.
+ *  \relates adbus_SharedMsg
+ */
+void adbus_smsg_deref(adbus_SharedMsg* s)
+{
+    if (s && adbus_InterlockedDecrement(&s->ref) == 0) {
+        free(s->alloc);
+        free(s);
+    }
+}
@@ -25,7 +25,7 @@
 
 
 #define ADBUS_LIBRARY
-#include "misc.h"
+#include "connection.h"
 
 #include "dmem/string.h"
 
@@ -57,6 +57,15 @@
  *  -# Call adbus_call_send() to send off the message and register for any
  *  callbacks.
  *
+ *  To give up waiting for a reply set adbus_Call::timeout to a timeout in
+ *  milliseconds. The error callback is then called with a NoReply error if
+ *  no reply has come in by the time adbus_conn_timeout() is next called after
+ *  the timeout.
+ *
+ *  Alternatively adbus_call_block() can be used in place of
+ *  adbus_call_send() to send the call and then wait for the reply (see
+ *  adbus_conn_block()). The callbacks are called before it returns.
+ *
  *  For example:
  *  \code
  *  struct my_state
@@ -339,18 +348,20 @@ void adbus_call_method(
       return;
 
     adbus_MsgFactory* m = p->message;
+    p->type = METHOD_CALL;
 
     memset(call, 0, sizeof(adbus_Call));
     call->msg = m;
 
-    adbus_msg_reset(m);
+    // The header fields are set to the same values for repeated calls to
+    // the same method, so the factory can reuse the previously encoded
+    // header.
+    adbus_msg_resetargs(m);
     adbus_msg_settype(m, ADBUS_MSG_METHOD);
     adbus_msg_setserial(m, adbus_conn_serial(p->connection));
     adbus_msg_setdestination(m, ds_cstr(&p->service), ds_size(&p->service));
     adbus_msg_setpath(m, ds_cstr(&p->path), ds_size(&p->path));
-
-    if (ds_size(&p->interface) > 0)
-        adbus_msg_setinterface(m, ds_cstr(&p->interface), ds_size(&p->interface));
+    adbus_msg_setinterface(m, ds_cstr(&p->interface), ds_size(&p->interface));
     adbus_msg_setmember(m, method, size);
 }
 
@@ -375,7 +386,7 @@ void adbus_call_setproperty(
     memset(call, 0, sizeof(adbus_Call));
     call->msg = m;
 
-    adbus_msg_reset(m);
+    adbus_msg_resetargs(m);
     adbus_msg_settype(m, ADBUS_MSG_METHOD);
     adbus_msg_setserial(m, adbus_conn_serial(p->connection));
     adbus_msg_setdestination(m, ds_cstr(&p->service), ds_size(&p->service));
@@ -409,7 +420,7 @@ void adbus_call_getproperty(
     memset(call, 0, sizeof(adbus_Call));
     call->msg = m;
 
-    adbus_msg_reset(m);
+    adbus_msg_resetargs(m);
     adbus_msg_settype(m, ADBUS_MSG_METHOD);
     adbus_msg_setserial(m, adbus_conn_serial(p->connection));
     adbus_msg_setdestination(m, ds_cstr(&p->service), ds_size(&p->service));
@@ -456,6 +467,7 @@ void adbus_call_send(
         r.ruser[0]      = call->ruser[0];
         r.release[1]    = call->release[1];
         r.ruser[1]      = call->ruser[1];
+        r.timeout       = call->timeout;
 
         if (p->state) {
             adbus_state_addreply(p->state, p->connection, &r);
@@ -475,8 +487,128 @@ void adbus_call_send(
     adbus_msg_send(msg, p->connection);
 }
 
+/* ------------------------------------------------------------------------- */
+
+struct BlockingCall
+{
+    adbus_Connection*   connection;
+    adbus_Call          call;
+    adbus_Bool          done;
+    adbus_Bool          registered;
+    int                 ret;
+};
+
+static int BlockingCallback(
+        struct BlockingCall*    b,
+        adbus_MsgCallback       cb,
+        void*                   user,
+        adbus_CbData*           d)
+{
+    int ret = 0;
+    b->done = 1;
+
+    if (cb) {
+        d->user1 = user;
+        ret = adbus_dispatch(cb, d);
+    }
+
+    adbusI_unblock(b->connection);
+    return ret;
+}
 
+static int BlockingReply(adbus_CbData* d)
+{
+    struct BlockingCall* b = (struct BlockingCall*) d->user1;
+    b->ret = BlockingCallback(b, b->call.callback, b->call.cuser, d);
+    return b->ret;
+}
 
+static int BlockingError(adbus_CbData* d)
+{
+    struct BlockingCall* b = (struct BlockingCall*) d->user1;
+    b->ret = -1;
+    return BlockingCallback(b, b->call.error, b->call.euser, d);
+}
 
+static void BlockingRelease(void* u)
+{
+    struct BlockingCall* b = (struct BlockingCall*) u;
+    b->registered = 0;
 
+    if (b->call.release[0]) {
+        b->call.release[0](b->call.ruser[0]);
+    }
+    if (b->call.release[1]) {
+        b->call.release[1](b->call.ruser[1]);
+    }
+}
 
+/** Send off a call and block until the reply comes back
+ *  \relates adbus_Proxy
+ *
+ *  The reply or error callback in the call is called before this returns.
+ *  The proxy's state is not used, as the reply is always removed before
+ *  returning.
+ *
+ *  \param[in] p            The proxy.
+ *  \param[in] call         The call setup with adbus_call_method() etc.
+ *  \param[in] timeoutms    Timeout in milliseconds or -1 to use
+ *                          adbus_Call::timeout (if set) or wait forever.
+ *
+ *  \return the return value of the reply callback, or -1 if an error reply
+ *  came back, the call timed out, or on a connection error
+ *
+ *  \warning This should only be called on the connection thread.
+ *
+ *  \sa adbus_conn_block()
+ */
+int adbus_call_block(
+        adbus_Proxy*        p,
+        adbus_Call*         call,
+        int                 timeoutms)
+{
+    adbus_MsgFactory* msg = p->message;
+
+    if (p->type == SET_PROP_CALL) {
+        adbus_msg_endvariant(msg, &p->variant);
+    }
+
+    adbus_msg_end(msg);
+
+    if (timeoutms < 0 && call->timeout > 0) {
+        timeoutms = call->timeout;
+    }
+
+    struct BlockingCall b;
+    ZERO(&b);
+    b.connection    = p->connection;
+    b.call          = *call;
+    b.registered    = 1;
+    b.ret           = -1;
+
+    adbus_Reply r;
+    adbus_reply_init(&r);
+
+    r.serial        = (uint32_t) adbus_msg_serial(msg);
+    r.remote        = ds_cstr(&p->service);
+    r.remoteSize    = ds_size(&p->service);
+    r.callback      = &BlockingReply;
+    r.cuser         = &b;
+    r.error         = &BlockingError;
+    r.euser         = &b;
+    r.release[0]    = &BlockingRelease;
+    r.ruser[0]      = &b;
+    r.timeout       = timeoutms > 0 ? timeoutms : 0;
+
+    adbus_ConnReply* reply = adbus_conn_addreply(p->connection, &r);
+
+    if (adbus_msg_send(msg, p->connection) == 0) {
+        adbusI_block(p->connection, &b.done, timeoutms);
+    }
+
+    if (b.registered) {
+        adbus_conn_removereply(p->connection, reply);
+    }
+
+    return b.ret;
+}
@@ -0,0 +1,126 @@
+/* vim: ts=4 sw=4 sts=4 et
+ *
+ * Copyright (c) 2009 James R. McKaskill
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * ----------------------------------------------------------------------------
+ */
+
+#define ADBUS_LIBRARY
+#include "misc.h"
+
+/* -------------------------------------------------------------------------- */
+int adbusI_queue_push(
+        adbusI_SendQueue*       q,
+        adbus_Message*          m,
+        adbus_SendMsgsCallback  cb,
+        void*                   user)
+{
+    assert(q->threshold > 0);
+
+    adbus_SharedMsg** pmsg = dv_push(SharedMsg, &q->msgs, 1);
+    *pmsg = adbus_msg_share(m);
+    q->size += m->size;
+
+    if (q->size >= q->threshold)
+        return adbusI_queue_flush(q, cb, user);
+
+    return 0;
+}
+
+/* -------------------------------------------------------------------------- */
+int adbusI_queue_flush(
+        adbusI_SendQueue*       q,
+        adbus_SendMsgsCallback  cb,
+        void*                   user)
+{
+    size_t num = dv_size(&q->msgs);
+    if (num == 0)
+        return 0;
+
+    adbus_ssize_t sent = cb ? cb(user, &dv_a(&q->msgs, 0), num) : -1;
+
+    for (size_t i = 0; i < num; i++) {
+        adbus_smsg_deref(dv_a(&q->msgs, i));
+    }
+    dv_clear(SharedMsg, &q->msgs);
+
+    size_t size = q->size;
+    q->size = 0;
+
+    // As with adbus_SendMsgCallback, anything except the full size is
+    // considered an error
+    return sent != (adbus_ssize_t) size;
+}
+
+/* -------------------------------------------------------------------------- */
+void adbusI_queue_free(adbusI_SendQueue* q)
+{
+    for (size_t i = 0; i < dv_size(&q->msgs); i++) {
+        adbus_smsg_deref(dv_a(&q->msgs, i));
+    }
+    dv_free(SharedMsg, &q->msgs);
+    q->size = 0;
+}
+
+/* -------------------------------------------------------------------------- */
+adbus_Bool adbusI_mpsc_push(
+        adbusI_QueuedMsg* volatile* head,
+        adbus_Message*              m)
+{
+    adbusI_QueuedMsg* q = NEW(adbusI_QueuedMsg);
+    q->msg = adbus_msg_share(m);
+
+    adbusI_QueuedMsg* old;
+    do {
+        old = *head;
+        q->next = old;
+    } while (adbus_InterlockedCompareExchangePointer((void* volatile*) head, q, old) != old);
+
+    return old == NULL;
+}
+
+/* -------------------------------------------------------------------------- */
+void adbusI_mpsc_take(
+        adbusI_QueuedMsg* volatile* head,
+        adbusI_SendQueue*           q)
+{
+    adbusI_QueuedMsg* list;
+    do {
+        list = *head;
+        if (list == NULL)
+            return;
+    } while (adbus_InterlockedCompareExchangePointer((void* volatile*) head, NULL, list) != list);
+
+    // The list is newest first, so fill the queue in from the back
+    size_t num = 0;
+    for (adbusI_QueuedMsg* i = list; i != NULL; i = i->next) {
+        num++;
+    }
+
+    adbus_SharedMsg** dest = dv_push(SharedMsg, &q->msgs, num) + num;
+    while (list) {
+        adbusI_QueuedMsg* next = list->next;
+        *(--dest) = list->msg;
+        q->size += list->msg->size;
+        free(list);
+        list = next;
+    }
+}
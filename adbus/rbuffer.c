@@ -169,10 +169,59 @@ struct adbus_Buffer
 {
     /** \privatesection */
     d_Vector(char)  b;
+    size_t          begin;
+    size_t          moved;
+    size_t          grows;
+    size_t          recvsize;
     char            sig[256];
     const char*     sigp;
 };
 
+// Data before b->begin has been consumed by adbus_buf_remove() but not yet
+// moved out of the way. The live data is only moved back to the start of the
+// allocation when we run out of room at the end and there is at least as
+// much consumed space as live data (ie the move costs no more than growing
+// would). Otherwise the allocation is doubled so that large messages arriving
+// in small reads are only recopied O(log n) times.
+
+#define Data(b) (dv_data(&(b)->b) + (b)->begin)
+#define Size(b) (dv_size(&(b)->b) - (b)->begin)
+
+static void Compact(adbus_Buffer* b)
+{
+    size_t size = Size(b);
+    if (size > 0) {
+        memmove(dv_data(&b->b), Data(b), size);
+        b->moved += size;
+    }
+    b->b.size = size;
+    b->begin = 0;
+}
+
+static void Reserve(adbus_Buffer* b, size_t sz)
+{
+    if (b->begin + sz <= b->b.alloc)
+        return;
+
+    if (b->begin > 0 && b->begin >= Size(b))
+        Compact(b);
+
+    if (b->begin + sz > b->b.alloc) {
+        size_t alloc = b->b.alloc * 2;
+        if (alloc < b->begin + sz)
+            alloc = b->begin + sz;
+        b->moved += dv_size(&b->b);
+        b->grows++;
+        dv_reserve(char, &b->b, alloc);
+    }
+}
+
+static char* Push(adbus_Buffer* b, size_t num)
+{
+    Reserve(b, Size(b) + num);
+    return dv_push(char, &b->b, num);
+}
+
 /** Creates a new buffer.
  *  \relates adbus_Buffer 
  */
@@ -198,13 +247,13 @@ void adbus_buf_free(adbus_Buffer* b)
  *  \relates adbus_Buffer 
  */
 char* adbus_buf_data(const adbus_Buffer* b)
-{ return dv_data(&b->b); }
+{ return Data(b); }
 
 /** Returns the size of the data in the buffer.
  *  \relates adbus_Buffer
  */
 size_t adbus_buf_size(const adbus_Buffer* b)
-{ return dv_size(&b->b); }
+{ return Size(b); }
 
 /** Releases the internal buffer and returns it.
  *
@@ -220,6 +269,8 @@ size_t adbus_buf_size(const adbus_Buffer* b)
  */
 char* adbus_buf_release(adbus_Buffer* b)
 { 
+    if (b->begin > 0)
+        Compact(b);
     b->sig[0] = '\0';
     b->sigp   = b->sig;
     return dv_release(char, &b->b); 
@@ -238,6 +289,7 @@ char* adbus_buf_release(adbus_Buffer* b)
 void adbus_buf_reset(adbus_Buffer* b)
 { 
     dv_clear(char, &b->b); 
+    b->begin  = 0;
     b->sig[0] = '\0';
     b->sigp   = b->sig;
 }
@@ -314,20 +366,68 @@ void adbus_buf_appendsig(adbus_Buffer* b, const char* sig, int size)
  *  \sa adbus_buf_recvbuf, adbus_buf_recvd
  */
 void adbus_buf_reserve(adbus_Buffer* b, size_t sz)
-{ dv_reserve(char, &b->b, sz); }
+{ Reserve(b, sz); }
 
 /** Removes a chunk of data from the buffer
  *  \relates adbus_Buffer
+ *
+ *  Removing data from the front of the buffer (as the parse functions do
+ *  after consuming messages) does not move the remaining data. Instead the
+ *  consumed space is reclaimed the next time the buffer would need to grow.
  */
 void adbus_buf_remove(adbus_Buffer* b, size_t off, size_t num)
-{ dv_remove(char, &b->b, off, num); }
+{ 
+    assert(off + num <= Size(b));
+    if (off == 0) {
+        b->begin += num;
+        if (b->begin == dv_size(&b->b)) {
+            dv_clear(char, &b->b);
+            b->begin = 0;
+        }
+    } else {
+        b->moved += Size(b) - off - num;
+        dv_remove(char, &b->b, b->begin + off, num);
+    }
+}
+
+// Used by adbus_conn_parse when it has the header of a message but not the
+// rest. We also leave room for the next adbus_buf_recvbuf so that the final
+// read of the message does not force a regrowth.
+void adbusI_buf_reservemsg(adbus_Buffer* b, size_t size)
+{
+    if (b->begin % 8 != 0)
+        Compact(b);
+    Reserve(b, size + b->recvsize);
+}
+
+char* adbusI_buf_push(adbus_Buffer* b, size_t size)
+{ return Push(b, size); }
+
+/** Returns statistics on how much data the buffer has had to copy.
+ *  \relates adbus_Buffer
+ *
+ *  \param[in]  b        Buffer to query
+ *  \param[out] moved    Bytes moved either to reclaim removed data or when
+ *                       growing the allocation (assuming realloc copies).
+ *  \param[out] grows    Number of times the allocation has been grown.
+ *
+ *  Either out param may be NULL. The stats are not cleared by
+ *  adbus_buf_reset().
+ */
+void adbus_buf_stats(const adbus_Buffer* b, size_t* moved, size_t* grows)
+{
+    if (moved)
+        *moved = b->moved;
+    if (grows)
+        *grows = b->grows;
+}
 
 /** Appends a chunk of data to the buffer
  *  \relates adbus_Buffer
  */
 void adbus_buf_append(adbus_Buffer* b, const char* data, size_t sz)
 {
-    char* dest = dv_push(char, &b->b, sz);
+    char* dest = Push(b, sz);
     memcpy(dest, data, sz);
 }
 
@@ -361,14 +461,14 @@ int adbus_buf_appendvalue(adbus_Buffer* b, adbus_Iterator* i)
  */
 const char* adbus_buf_line(adbus_Buffer* b, size_t* sz)
 {
-    char* end = (char*) memchr(dv_data(&b->b), '\n', dv_size(&b->b));
+    char* end = (char*) memchr(Data(b), '\n', Size(b));
     if (!end)
         return NULL;
 
     if (sz)
-        *sz = end + 1 - dv_data(&b->b);
+        *sz = end + 1 - Data(b);
 
-    return dv_data(&b->b);
+    return Data(b);
 }
 
 /** Reserves a buffer to directly append data.
@@ -389,7 +489,10 @@ const char* adbus_buf_line(adbus_Buffer* b, size_t* sz)
  *
  */
 char* adbus_buf_recvbuf(adbus_Buffer* b, size_t len)
-{ return dv_push(char, &b->b, len); }
+{ 
+    b->recvsize = len;
+    return Push(b, len); 
+}
 
 
 /** Clears out the extra space not used by a adbus_buf_recvbuf().
@@ -413,8 +516,8 @@ void adbus_buf_recvd(adbus_Buffer* b, size_t len, adbus_ssize_t recvd)
 
 INLINE void Align(adbus_Buffer* b, int alignment)
 {
-    int append = ADBUSI_ALIGN(dv_size(&b->b), alignment) - dv_size(&b->b);
-    char* dest = dv_push(char, &b->b, append);
+    int append = ADBUSI_ALIGN(Size(b), alignment) - Size(b);
+    char* dest = Push(b, append);
     for (int i = 0; i < append; i++) {
         dest[i] = '\0';
     }
@@ -499,7 +602,7 @@ void adbus_buf_alignfield(adbus_Buffer* b, char field)
 
 INLINE void Append8(adbus_Buffer* b, uint8_t v)
 {
-    uint8_t* dest = (uint8_t*) dv_push(char, &b->b, 1);
+    uint8_t* dest = (uint8_t*) Push(b, 1);
     *dest = v;
 }
 
@@ -507,21 +610,21 @@ INLINE void Append8(adbus_Buffer* b, uint8_t v)
 INLINE void Append16(adbus_Buffer* b, uint16_t v)
 {
     Align(b, 2);
-    uint16_t* dest = (uint16_t*) dv_push(char, &b->b, 2);
+    uint16_t* dest = (uint16_t*) Push(b, 2);
     *dest = v;
 }
 
 INLINE void Append32(adbus_Buffer* b, uint32_t v)
 {
     Align(b, 4);
-    uint32_t* dest = (uint32_t*) dv_push(char, &b->b, 4);
+    uint32_t* dest = (uint32_t*) Push(b, 4);
     *dest = v;
 }
 
 INLINE void Append64(adbus_Buffer* b, uint64_t v)
 {
     Align(b, 8);
-    uint64_t* dest = (uint64_t*) dv_push(char, &b->b, 8);
+    uint64_t* dest = (uint64_t*) Push(b, 8);
     *dest = v;
 }
 
@@ -588,7 +691,7 @@ void adbus_buf_string(adbus_Buffer* b, const char* str, int size)
         size = strlen(str);
     assert((size_t) size <= UINT32_MAX);
     Append32(b, (uint32_t) size);
-    char* dest = dv_push(char, &b->b, size + 1);
+    char* dest = Push(b, size + 1);
     memcpy(dest, str, size);
     dest[size] = '\0';
 }
@@ -603,7 +706,7 @@ void adbus_buf_objectpath(adbus_Buffer* b, const char* str, int size)
         size = strlen(str);
     assert((size_t) size <= UINT32_MAX);
     Append32(b, (uint32_t) size);
-    char* dest = dv_push(char, &b->b, size + 1);
+    char* dest = Push(b, size + 1);
     memcpy(dest, str, size);
     dest[size] = '\0';
 }
@@ -618,7 +721,7 @@ void adbus_buf_signature(adbus_Buffer* b, const char* str, int size)
         size = strlen(str);
     assert(size < UINT8_MAX);
     Append8(b, (uint8_t) size);
-    char* dest = dv_push(char, &b->b, size + 1);
+    char* dest = Push(b, size + 1);
     memcpy(dest, str, size);
     dest[size] = '\0';
 }
@@ -633,7 +736,7 @@ void adbus_buf_beginvariant(adbus_Buffer* b, adbus_BufVariant* v, const char* si
         size = strlen(sig);
     assert(size < UINT8_MAX);
     Append8(b, (uint8_t) size);
-    char* dest = dv_push(char, &b->b, size + 1);
+    char* dest = Push(b, size + 1);
     memcpy(dest, sig, size);
     dest[size] = '\0';
     v->oldsig = b->sigp;
@@ -656,9 +759,9 @@ void adbus_buf_beginarray(adbus_Buffer* b, adbus_BufArray* a)
 {
     SIG(b, 'a');
     Append32(b, 0);
-    a->szindex = dv_size(&b->b) - 4;
+    a->szindex = Size(b) - 4;
     adbus_buf_alignfield(b, *b->sigp);
-    a->dataindex = dv_size(&b->b);
+    a->dataindex = Size(b);
     a->sigbegin = b->sigp;
     a->sigend = adbus_nextarg(b->sigp);
 }
@@ -682,11 +785,41 @@ void adbus_buf_checkarrayentry(adbus_Buffer* b, adbus_BufArray* a)
  */
 void adbus_buf_endarray(adbus_Buffer* b, adbus_BufArray* a)
 {
-    uint32_t* sz = (uint32_t*) &dv_a(&b->b, a->szindex);
-    *sz = dv_size(&b->b) - a->dataindex;
+    uint32_t* sz = (uint32_t*) (Data(b) + a->szindex);
+    *sz = Size(b) - a->dataindex;
     b->sigp = a->sigend;
 }
 
+/** Appends a whole array of fixed size values (dbus sig "ay", "au", "ad",
+ *  etc).
+ *  \relates adbus_Buffer
+ *
+ *  \param[in] b       Buffer to append to
+ *  \param[in] data    Array data in native endianness
+ *  \param[in] size    Size of the array data in bytes
+ *
+ *  This is equivalent to beginning an array, appending each value and then
+ *  ending the array, but copies the data in one go. The element type must be
+ *  one of y, n, q, b, i, u, x, t, or d.
+ *
+ *  For example to append an "ay" blob:
+ *
+ *  \code
+ *  adbus_buf_setsig(b, "ay", 2);
+ *  adbus_buf_fixedarray(b, blob, blobsize);
+ *  \endcode
+ */
+void adbus_buf_fixedarray(adbus_Buffer* b, const char* data, size_t size)
+{
+    adbus_BufArray a;
+    adbus_buf_beginarray(b, &a);
+    assert(a.sigend == a.sigbegin + 1);
+    assert(adbusI_iter_fixedwidth(*a.sigbegin) > 0);
+    assert(size % adbusI_iter_fixedwidth(*a.sigbegin) == 0);
+    adbus_buf_append(b, data, size);
+    adbus_buf_endarray(b, &a);
+}
+
 /** Begins a dict entry (dbus sig "{").
  *  \relates adbus_Buffer
  */
@@ -695,7 +828,7 @@ void adbus_buf_begindictentry(adbus_Buffer* b)  { SIG(b, '{'); Align(b, 8); }
 /** Ends a dict entry (dbus sig "}").
  *  \relates adbus_Buffer
  */
-void adbus_buf_enddictentry(adbus_Buffer* b)    { SIG(b, '{'); }
+void adbus_buf_enddictentry(adbus_Buffer* b)    { SIG(b, '}'); }
 
 /** Begins a struct (dbus sig "(").
  *  \relates adbus_Buffer
@@ -27,6 +27,7 @@
 #include "connection.h"
 #include "misc.h"
 #include "stdio.h"
+#include <limits.h>
 /** \struct adbus_Reply
  *  \brief Data structure to register for return and error messages from a
  *  method call.
@@ -166,6 +167,15 @@
  *  Normally this should be set using adbus_conn_getproxy().
  */
 
+/** \var adbus_Reply::timeout
+ *  Timeout in milliseconds or 0 (default) for no timeout.
+ *
+ *  If no reply or error has come in by the timeout, the error callback is
+ *  called with a synthesised org.freedesktop.DBus.Error.NoReply error and the
+ *  reply is removed. Timeouts are only checked when adbus_conn_timeout() is
+ *  called.
+ */
+
 
 // ----------------------------------------------------------------------------
 
@@ -180,6 +190,31 @@ void adbus_reply_init(adbus_Reply* r)
 
 // ----------------------------------------------------------------------------
 
+// Inserts the reply into the slot of the timeout wheel given by the first
+// group of bits in which its deadline differs from the wheel time (see
+// connection.h)
+static void AddTimeout(adbus_Connection* c, adbus_ConnReply* r)
+{
+    int64_t range = (int64_t) 1 << (ADBUSI_WHEEL_BITS * ADBUSI_WHEEL_LEVELS);
+    int64_t when = r->deadline;
+    if (when <= c->wheelTime) {
+        when = c->wheelTime + 1;
+    } else if (when - c->wheelTime >= range) {
+        when = c->wheelTime + range - 1;
+    }
+
+    uint64_t diff = (uint64_t) (when ^ c->wheelTime);
+    int level = 0;
+    while (level < ADBUSI_WHEEL_LEVELS - 1 && (diff >> (ADBUSI_WHEEL_BITS * (level + 1))) != 0) {
+        level++;
+    }
+
+    int slot = (int) (when >> (ADBUSI_WHEEL_BITS * level)) & (ADBUSI_WHEEL_SLOTS - 1);
+    dil_insert_after(Reply, &c->timeouts[level][slot], r, &r->tl);
+}
+
+// ----------------------------------------------------------------------------
+
 /** Registers a reply with the connection.
  *  \relates adbus_Connection
  *
@@ -211,6 +246,10 @@ adbus_ConnReply* adbus_conn_addreply(
         name = service->unique;
     }
 
+    if (*name.str == ':' && !c->watchingRemotes) {
+        adbusI_watchRemotes(c);
+    }
+
     // Lookup the remote
 
     struct Remote* remote = NULL;
@@ -239,6 +278,7 @@ adbus_ConnReply* adbus_conn_addreply(
     }
 
     adbus_ConnReply* reply  = NEW(adbus_ConnReply);
+    reply->connection       = c;
     reply->remote           = remote;
     reply->serial           = serial;
     reply->callback         = reg->callback;
@@ -259,14 +299,24 @@ adbus_ConnReply* adbus_conn_addreply(
 
     dil_insert_after(Reply, &c->replies, reply, &reply->fl);
 
+    if (reg->timeout > 0) {
+        int64_t now = adbusI_clock();
+        // The wheel can be moved straight to now if there is nothing in it
+        if (c->timeoutCount == 0 && now > c->wheelTime) {
+            c->wheelTime = now;
+        }
+        reply->deadline = now + reg->timeout;
+        AddTimeout(c, reply);
+        c->timeoutCount++;
+    }
+
     return reply;
 }
 
 // ----------------------------------------------------------------------------
 
-void adbusI_freeReply(adbus_ConnReply* r)
+static void DetachRemote(adbus_ConnReply* r)
 {
-    // Disconnect from remote
     if (r->remote) {
         d_Hash(Reply)* h = &r->remote->replies;
         dh_Iter ii = dh_get(Reply, h, r->serial);
@@ -275,9 +325,23 @@ void adbusI_freeReply(adbus_ConnReply* r)
         }
 
         // See if we need to free the remote
-        if (dh_size(h) == 0) {
+        if (dh_size(h) == 0 && !r->remote->failing) {
             adbusI_freeRemote(r->remote);
         }
+        r->remote = NULL;
+    }
+}
+
+void adbusI_freeReply(adbus_ConnReply* r)
+{
+    // Disconnect from remote
+    DetachRemote(r);
+
+    // Disconnect from the timeout wheel
+    if (r->deadline) {
+        dil_remove(Reply, r, &r->tl);
+        r->connection->timeoutCount--;
+        r->deadline = 0;
     }
 
     if (r->release[0]) {
@@ -426,3 +490,180 @@ int adbusI_dispatchReply(adbus_CbData* d)
     return ret;
 }
 
+// ----------------------------------------------------------------------------
+
+// Calls the error callback with a NoReply error and removes the reply
+static void FailReply(
+        adbus_Connection*   c,
+        adbus_ConnReply*    reply,
+        adbus_MsgFactory*   f,
+        const char*         message)
+{
+    adbus_msg_reset(f);
+    adbus_msg_settype(f, ADBUS_MSG_ERROR);
+    adbus_msg_setflags(f, ADBUS_MSG_NO_REPLY);
+    adbus_msg_setserial(f, adbus_conn_serial(c));
+    adbus_msg_setreply(f, reply->serial);
+    adbus_msg_seterror(f, "org.freedesktop.DBus.Error.NoReply", -1);
+    if (reply->remote) {
+        adbus_msg_setsender(f, reply->remote->name.str, (int) reply->remote->name.sz);
+    }
+    adbus_msg_setsig(f, "s", 1);
+    adbus_msg_string(f, message, -1);
+
+    adbus_Message m;
+    if (adbus_msg_build(f, &m))
+        return;
+
+    // Remove the reply from the remote before calling the callback as with
+    // a normal reply
+    DetachRemote(reply);
+    dil_setiter(&c->replies, reply);
+
+    if (reply->error) {
+        adbus_CbData d;
+        ZERO(&d);
+        d.connection = c;
+        d.msg        = &m;
+        d.noreturn   = 1;
+        d.user1      = reply->euser;
+
+        if (reply->proxy) {
+            reply->proxy(reply->puser, reply->error, &d);
+        } else {
+            adbus_dispatch(reply->error, &d);
+        }
+    }
+
+    adbus_ConnReply* reply2 = dil_getiter(&c->replies);
+    dil_setiter(&c->replies, NULL);
+
+    if (reply == reply2) {
+        adbusI_freeReply(reply);
+    }
+}
+
+void adbusI_failRemote(adbus_Connection* c, dh_strsz_t name)
+{
+    dh_Iter ii = dh_get(Remote, &c->remotes, name);
+    if (ii == dh_end(&c->remotes))
+        return;
+
+    struct Remote* remote = dh_val(&c->remotes, ii);
+
+    // Take the remote out of the connection so that any replies added by the
+    // callbacks get a new remote. Nothing else can then add to this remote's
+    // table, so we can walk it whilst the callbacks remove replies.
+    dh_del(Remote, &c->remotes, ii);
+    remote->connection = NULL;
+    remote->failing    = 1;
+
+    adbus_MsgFactory* f = adbus_msg_new();
+    d_Hash(Reply)* h = &remote->replies;
+    for (dh_Iter jj = dh_begin(h); jj != dh_end(h) && dh_size(h) > 0; jj++) {
+        if (dh_exist(h, jj)) {
+            FailReply(c, dh_val(h, jj), f, "Remote disconnected from the bus without replying");
+        }
+    }
+    adbus_msg_free(f);
+
+    adbusI_freeRemote(remote);
+}
+
+// ----------------------------------------------------------------------------
+
+/** Expires replies whose timeout has passed and returns the time until the
+ *  next reply timeout.
+ *  \relates adbus_Connection
+ *
+ *  \return The number of milliseconds until the next call is needed or -1 if
+ *  there are no replies with a timeout. This is suitable to pass directly to
+ *  poll or similar. The returned time may be earlier than the next actual
+ *  timeout.
+ *
+ *  Expired replies have their error callback called with an
+ *  org.freedesktop.DBus.Error.NoReply error and are then removed. Insertion
+ *  and expiry of each reply is O(1).
+ *
+ *  \warning This should only be called on the connection thread.
+ *
+ *  \sa adbus_Reply::timeout
+ */
+int adbus_conn_timeout(adbus_Connection* c)
+{
+    if (c->timeoutCount == 0)
+        return -1;
+
+    int64_t now = adbusI_clock();
+
+    if (now > c->wheelTime) {
+        int64_t old = c->wheelTime;
+        c->wheelTime = now;
+
+        // Pull out every reply in the slots that have been passed at each
+        // level. Once a level hasn't moved none of the higher levels have
+        // either.
+        d_IList(Reply) pending;
+        dil_init(Reply, &pending);
+
+        for (int level = 0; level < ADBUSI_WHEEL_LEVELS; level++) {
+            int shift = ADBUSI_WHEEL_BITS * level;
+            int64_t from = (old >> shift) + 1;
+            int64_t to = now >> shift;
+            if (to < from)
+                break;
+            if (to - from >= ADBUSI_WHEEL_SLOTS) {
+                to = from + ADBUSI_WHEEL_SLOTS - 1;
+            }
+
+            for (int64_t i = from; i <= to; i++) {
+                d_IList(Reply)* slot = &c->timeouts[level][i & (ADBUSI_WHEEL_SLOTS - 1)];
+                adbus_ConnReply* r;
+                while ((r = slot->next) != NULL) {
+                    dil_remove(Reply, r, &r->tl);
+                    dil_insert_after(Reply, &pending, r, &r->tl);
+                }
+            }
+        }
+
+        // The callbacks may remove other pending replies so we pop them off
+        // one at a time
+        adbus_MsgFactory* f = NULL;
+        adbus_ConnReply* r;
+        while ((r = pending.next) != NULL) {
+            dil_remove(Reply, r, &r->tl);
+            if (r->deadline <= now) {
+                if (!f) {
+                    f = adbus_msg_new();
+                }
+                FailReply(c, r, f, "Did not receive a reply within the timeout");
+            } else {
+                AddTimeout(c, r);
+            }
+        }
+
+        adbus_msg_free(f);
+
+        if (c->timeoutCount == 0)
+            return -1;
+    }
+
+    // Find the earliest slot we need to come back for. For the higher levels
+    // this is when the slot is cascaded down rather than the actual deadline.
+    int64_t next = -1;
+    for (int level = 0; level < ADBUSI_WHEEL_LEVELS; level++) {
+        int shift = ADBUSI_WHEEL_BITS * level;
+        int64_t base = c->wheelTime >> shift;
+        for (int64_t i = 1; i <= ADBUSI_WHEEL_SLOTS; i++) {
+            if (!dil_isempty(&c->timeouts[level][(base + i) & (ADBUSI_WHEEL_SLOTS - 1)])) {
+                int64_t when = ((base + i) << shift) - c->wheelTime;
+                if (next < 0 || when < next) {
+                    next = when;
+                }
+                break;
+            }
+        }
+    }
+
+    return next > INT_MAX ? INT_MAX : (int) next;
+}
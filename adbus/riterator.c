@@ -174,14 +174,7 @@ static int Flip64(adbus_Iterator* i)
         return -1;
 
     uint64_t* p = (uint64_t*) i->data;
-    *p =  ((*p & UINT64_C(0xFF00000000000000)) >> 56)
-        | ((*p & UINT64_C(0x00FF000000000000)) >> 40)
-        | ((*p & UINT64_C(0x0000FF0000000000)) >> 24)
-        | ((*p & UINT64_C(0x000000FF00000000)) >> 8)
-        | ((*p & UINT64_C(0x00000000FF000000)) << 8)
-        | ((*p & UINT64_C(0x0000000000FF0000)) << 16)
-        | ((*p & UINT64_C(0x000000000000FF00)) << 40)
-        | ((*p & UINT64_C(0x00000000000000FF)) << 56);
+    *p = ADBUSI_FLIP64(*p);
 
     i->data += 8;
     i->size -= 8;
@@ -195,9 +188,20 @@ static int FlipArray(adbus_Iterator* i)
     if (Flip32(i, 0) || adbus_iter_beginarray(i, &a))
         return -1;
 
-    while (adbus_iter_inarray(i, &a)) {
-        if (adbus_flip_value((char**) &i->data, &i->size, &i->sig)) {
+    int width = (a.sigsz == 1) ? adbusI_iter_fixedwidth(*a.sig) : 0;
+
+    if (width > 0) {
+        // Arrays of fixed size values are flipped in bulk
+        if (a.size % width != 0)
             return -1;
+        if (width > 1)
+            adbusI_flipArray((char*) a.data, a.size, width);
+
+    } else {
+        while (adbus_iter_inarray(i, &a)) {
+            if (adbus_flip_value((char**) &i->data, &i->size, &i->sig)) {
+                return -1;
+            }
         }
     }
 
@@ -210,7 +214,8 @@ static int FlipVariant(adbus_Iterator* i)
     if (adbus_iter_beginvariant(i, &v))
         return -1;
 
-    adbus_flip_value((char**) &i->data, &i->size, &i->sig);
+    if (adbus_flip_value((char**) &i->data, &i->size, &i->sig))
+        return -1;
 
     return adbus_iter_endvariant(i, &v);
 }
@@ -225,7 +230,7 @@ int adbus_flip_value(char** data, size_t* size, const char** sig)
 
     int ret = 0;
 
-    switch (*(i.sig)++) 
+    switch (*i.sig)
     {
         case 'y':
             ret = adbus_iter_u8(&i, NULL);
@@ -234,17 +239,21 @@ int adbus_flip_value(char** data, size_t* size, const char** sig)
         case 'n':
         case 'q':
             ret = Flip16(&i);
+            i.sig++;
             break;
 
         case 'b':
         case 'i':
         case 'u':
             ret = Flip32(&i, 1);
+            i.sig++;
             break;
 
         case 'x':
         case 't':
+        case 'd':
             ret = Flip64(&i);
+            i.sig++;
             break;
 
         case 's':
@@ -296,12 +305,14 @@ int adbus_flip_value(char** data, size_t* size, const char** sig)
     return ret;
 }
 
-/** Endian flips the entire buffer.
+/** Endian flips all of the values in sig.
  * \relates adbus_Buffer
+ *
+ * Any data after the last value (eg padding) is left as is.
  */
 int adbus_flip_data(char* data, size_t size, const char* sig)
 {
-    while (size > 0) {
+    while (*sig) {
         if (adbus_flip_value(&data, &size, &sig)) {
             return -1;
         }
@@ -310,6 +321,155 @@ int adbus_flip_data(char* data, size_t size, const char* sig)
 }
 
 
+// ----------------------------------------------------------------------------
+// Validation
+// ----------------------------------------------------------------------------
+
+// Limits the nesting of containers (including variants) so that a message
+// can not exhaust the stack
+#define MAXIMUM_DEPTH 64
+
+// Booleans must be 0 or 1. The data must already be in native endianness.
+static adbus_Bool IsValidBoolArray(const char* data, size_t size)
+{
+    const uint32_t* p = (const uint32_t*) data;
+    for (size_t j = 0; j < size / 4; j++) {
+        if (p[j] > 1)
+            return 0;
+    }
+    return 1;
+}
+
+static int ValidateValue(adbus_Iterator* i, int depth)
+{
+    const char* str;
+    size_t sz;
+
+    if (depth > MAXIMUM_DEPTH)
+        return -1;
+
+    switch (*i->sig)
+    {
+        case 's': // string
+            if (adbus_iter_string(i, &str, &sz) || !adbusI_isValidUtf8(str, sz))
+                return -1;
+            return 0;
+
+        case 'o': // object path
+            if (adbus_iter_objectpath(i, &str, &sz) || !adbusI_isValidObjectPath(str, sz))
+                return -1;
+            return 0;
+
+        case 'g': // signature
+            if (adbus_iter_signature(i, &str, &sz) || !adbusI_isValidSignature(str, sz))
+                return -1;
+            return 0;
+
+        case 'b': // boolean
+            {
+                const adbus_Bool* b;
+                if (adbus_iter_bool(i, &b) || *b > 1)
+                    return -1;
+                return 0;
+            }
+
+        case 'v': // variant
+            {
+                // The variant signature needs to be checked before we can
+                // align to the variant data so this can't use
+                // adbus_iter_beginvariant()
+                const uint8_t* len;
+                if (    adbusI_iter_sig(i, 'v')
+                    ||  adbusI_iter_get8(i, &len)
+                    ||  adbusI_iter_getstring(i, *len, &str, &sz)
+                    ||  sz == 0
+                    ||  adbus_nextarg(str) != str + sz
+                    ||  adbus_iter_alignfield(i, *str))
+                {
+                    return -1;
+                }
+
+                const char* origsig = i->sig;
+                i->sig = str;
+                if (ValidateValue(i, depth + 1))
+                    return -1;
+                i->sig = origsig;
+                return 0;
+            }
+
+        case 'a': // array
+            {
+                adbus_IterArray a;
+                if (adbus_iter_beginarray(i, &a))
+                    return -1;
+
+                // Arrays of fixed size types only need their length checked
+                // and so don't need to be walked
+                int width = (a.sigsz == 1) ? adbusI_iter_fixedwidth(*a.sig) : 0;
+
+                if (width > 0) {
+                    if (a.size % width != 0)
+                        return -1;
+                    if (*a.sig == 'b' && !IsValidBoolArray(a.data, a.size))
+                        return -1;
+
+                } else {
+                    while (adbus_iter_inarray(i, &a)) {
+                        if (ValidateValue(i, depth + 1))
+                            return -1;
+                    }
+                    // The last element must finish at the end of the array
+                    if (i->data != a.data + a.size)
+                        return -1;
+                }
+
+                return adbus_iter_endarray(i, &a);
+            }
+
+        case '(': // struct
+            if (adbus_iter_beginstruct(i))
+                return -1;
+            while (*i->sig != ')') {
+                if (ValidateValue(i, depth + 1))
+                    return -1;
+            }
+            return adbus_iter_endstruct(i);
+
+        case '{': // dict entry
+            if (adbus_iter_begindictentry(i))
+                return -1;
+            if (ValidateValue(i, depth + 1))
+                return -1;
+            if (ValidateValue(i, depth + 1))
+                return -1;
+            return adbus_iter_enddictentry(i);
+
+        default:
+            return adbus_iter_value(i);
+    }
+}
+
+/* Skips over a single complete type validating it on the way. As well as the
+ * checks done by adbus_iter_value(), strings must be valid UTF-8, object
+ * paths and signatures must be well formed, and variant signatures must be a
+ * single complete type. The signature the iterator points to must already
+ * have been validated.
+ */
+int adbusI_validateValue(adbus_Iterator* i)
+{ return ValidateValue(i, 0); }
+
+/* Validates every argument in data. */
+int adbusI_validateData(const char* data, size_t size, const char* sig)
+{
+    adbus_Iterator i = {data, size, sig};
+    while (*i.sig) {
+        if (ValidateValue(&i, 0))
+            return -1;
+    }
+    return 0;
+}
+
+
 
 
 // ----------------------------------------------------------------------------
@@ -441,36 +601,48 @@ double adbus_check_double(adbus_CbData* d)
     return *ret;
 }
 
-/** Pull out a string
+/** Pull out a string, checking that it is valid UTF-8
  *  \relates adbus_CbData
  */
 const char* adbus_check_string(adbus_CbData* d, size_t* size)
 {
     const char* ret;
+    size_t sz;
     Sig(d, 's');
-    Iter(d, adbus_iter_string(&d->checkiter, &ret, size));
+    Iter(d, adbus_iter_string(&d->checkiter, &ret, &sz));
+    Iter(d, !adbusI_isValidUtf8(ret, sz));
+    if (size)
+        *size = sz;
     return ret;
 }
 
-/** Pull out a object path
+/** Pull out a object path, checking that it is well formed
  *  \relates adbus_CbData
  */
 const char* adbus_check_objectpath(adbus_CbData* d, size_t* size)
 {
     const char* ret;
-    Sig(d, 's');
-    Iter(d, adbus_iter_string(&d->checkiter, &ret, size));
+    size_t sz;
+    Sig(d, 'o');
+    Iter(d, adbus_iter_objectpath(&d->checkiter, &ret, &sz));
+    Iter(d, !adbusI_isValidObjectPath(ret, sz));
+    if (size)
+        *size = sz;
     return ret;
 }
 
-/** Pull out a signature
+/** Pull out a signature, checking that it is well formed
  *  \relates adbus_CbData
  */
 const char* adbus_check_signature(adbus_CbData* d, size_t* size)
 {
     const char* ret;
-    Sig(d, 's');
-    Iter(d, adbus_iter_string(&d->checkiter, &ret, size));
+    size_t sz;
+    Sig(d, 'g');
+    Iter(d, adbus_iter_signature(&d->checkiter, &ret, &sz));
+    Iter(d, !adbusI_isValidSignature(ret, sz));
+    if (size)
+        *size = sz;
     return ret;
 }
 
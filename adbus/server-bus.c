@@ -178,7 +178,7 @@ static int AddMatch(adbus_CbData* d)
     adbus_Server* s = (adbus_Server*) d->user2;
     adbus_Remote* r = adbusI_serv_remote(s, d->msg->sender);
 
-    dl_insert_after(Match, &r->matches, m, &m->hl);
+    adbusI_serv_addmatch(s, r, m);
     return 0;
 }
 
@@ -195,7 +195,7 @@ static int RemoveMatch(adbus_CbData* d)
     struct Match* m;
     DL_FOREACH(Match, m, &r->matches, hl) {
         if (msize == m->size && memcmp(m->data, mstr, msize) == 0) {
-            dl_remove(Match, m, &m->hl);
+            adbusI_serv_removematch(s, m);
             adbusI_serv_freematch(m);
             break;
         }
@@ -221,7 +221,9 @@ static adbus_ssize_t SendToBus(void* d, adbus_Message* m)
 static adbus_ssize_t SendToServer(void* d, adbus_Message* m)
 {
     adbus_Server* s = (adbus_Server*) d;
-    if (adbus_remote_dispatch(s->busRemote, m))
+    // We are always called from within a dispatch so the server lock is
+    // already held
+    if (adbusI_remote_dispatch(s->busRemote, m))
         return -1;
 
     return m->size;
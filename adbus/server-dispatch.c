@@ -73,41 +73,181 @@ static adbus_Bool ArgsMatch(
     return 1;
 }
 
-static int RemoteDispatchMatch(adbus_Remote* r, adbus_Message* msg)
+/* -------------------------------------------------------------------------- */
+static d_Hash(MatchIndex)* IndexHash(adbus_Server* s, struct Match* m, dh_strsz_t* key)
 {
-    struct Match* match;
-    DL_FOREACH(Match, match, &r->matches, hl) {
-        if (match->type == ADBUS_MSG_INVALID && match->type != msg->type) {
-            continue;
-        } else if (match->checkReply && (!msg->replySerial || match->reply != *msg->replySerial)) {
-            continue;
-        } else if (!StringMatches(match->path, match->pathSize, msg->path, msg->pathSize)) {
-            continue;
-        } else if (!StringMatches(match->interface, match->interfaceSize, msg->interface, msg->interfaceSize)) {
-            continue;
-        } else if (!StringMatches(match->member, match->memberSize, msg->member, msg->memberSize)) {
-            continue;
-        } else if (!StringMatches(match->error, match->errorSize, msg->error, msg->errorSize)) {
-            continue;
-        } else if (!StringMatches(match->destination, match->destinationSize, msg->destination, msg->destinationSize)) {
-            continue;
-        } else if (!StringMatches(match->sender, match->senderSize, msg->sender, msg->senderSize)) {
+    if (m->member) {
+        key->str = m->member;
+        key->sz  = m->memberSize;
+        return &s->memberMatches;
+    } else if (m->interface) {
+        key->str = m->interface;
+        key->sz  = m->interfaceSize;
+        return &s->interfaceMatches;
+    } else if (m->path) {
+        key->str = m->path;
+        key->sz  = m->pathSize;
+        return &s->pathMatches;
+    } else if (m->sender) {
+        key->str = m->sender;
+        key->sz  = m->senderSize;
+        return &s->senderMatches;
+    } else {
+        return NULL;
+    }
+}
+
+void adbusI_serv_addmatch(adbus_Server* s, adbus_Remote* r, struct Match* m)
+{
+    m->remote = r;
+    dl_insert_after(Match, &r->matches, m, &m->hl);
+
+    dh_strsz_t key;
+    d_Hash(MatchIndex)* h = IndexHash(s, m, &key);
+    if (h == NULL) {
+        dl_insert_after(Match, &s->typeMatches[m->type], m, &m->il);
+        return;
+    }
+
+    int added;
+    dh_Iter ii = dh_put(MatchIndex, h, key, &added);
+    if (added) {
+        struct MatchIndex* index = (struct MatchIndex*) calloc(1, sizeof(struct MatchIndex) + key.sz);
+        memcpy(index->data, key.str, key.sz);
+        index->key.str = index->data;
+        index->key.sz  = key.sz;
+        dh_key(h, ii) = index->key;
+        dh_val(h, ii) = index;
+    }
+
+    m->index = dh_val(h, ii);
+    dl_insert_after(Match, &m->index->matches, m, &m->il);
+}
+
+void adbusI_serv_removematch(adbus_Server* s, struct Match* m)
+{
+    dl_remove(Match, m, &m->hl);
+    dl_remove(Match, m, &m->il);
+
+    struct MatchIndex* index = m->index;
+    if (index && index->matches.next == NULL) {
+        dh_strsz_t key;
+        d_Hash(MatchIndex)* h = IndexHash(s, m, &key);
+        dh_Iter ii = dh_get(MatchIndex, h, index->key);
+        assert(ii != dh_end(h));
+        dh_del(MatchIndex, h, ii);
+        free(index);
+    }
+
+    m->remote = NULL;
+    m->index  = NULL;
+}
+
+void adbusI_serv_freematches(adbus_Server* s)
+{
+    // All of the matches have been removed by the time this is called so all
+    // of the indexes should be empty
+    assert(dh_size(&s->memberMatches) == 0);
+    assert(dh_size(&s->interfaceMatches) == 0);
+    assert(dh_size(&s->pathMatches) == 0);
+    assert(dh_size(&s->senderMatches) == 0);
+    dh_free(MatchIndex, &s->memberMatches);
+    dh_free(MatchIndex, &s->interfaceMatches);
+    dh_free(MatchIndex, &s->pathMatches);
+    dh_free(MatchIndex, &s->senderMatches);
+}
+
+/* -------------------------------------------------------------------------- */
+// Returns 1 if the match matches, 0 if not, and -1 on error
+static int CheckMatch(struct Match* match, adbus_Message* msg, adbusI_Arena* arena)
+{
+    if (match->type != ADBUS_MSG_INVALID && match->type != msg->type) {
+        return 0;
+    } else if (match->checkReply && (!msg->replySerial || match->reply != *msg->replySerial)) {
+        return 0;
+    } else if (!StringMatches(match->path, match->pathSize, msg->path, msg->pathSize)) {
+        return 0;
+    } else if (!StringMatches(match->interface, match->interfaceSize, msg->interface, msg->interfaceSize)) {
+        return 0;
+    } else if (!StringMatches(match->member, match->memberSize, msg->member, msg->memberSize)) {
+        return 0;
+    } else if (!StringMatches(match->error, match->errorSize, msg->error, msg->errorSize)) {
+        return 0;
+    } else if (!StringMatches(match->destination, match->destinationSize, msg->destination, msg->destinationSize)) {
+        return 0;
+    } else if (!StringMatches(match->sender, match->senderSize, msg->sender, msg->senderSize)) {
+        return 0;
+    } else if (match->argumentsSize > 0) {
+        if (adbusI_parseargs(msg, arena))
+            return -1;
+        if (!ArgsMatch(match, msg))
+            return 0;
+    }
+
+    return 1;
+}
+
+/* -------------------------------------------------------------------------- */
+static int SendToRemote(adbus_Remote* r, adbus_Message* msg)
+{
+    // The threshold can only change with the server lock held exclusively
+    if (r->queue.threshold > 0) {
+        adbusI_remote_lockqueue(r);
+        int ret = adbusI_queue_push(&r->queue, msg, r->sendmsgs, r->data);
+        adbusI_remote_unlockqueue(r);
+        return ret;
+    }
+
+    return r->send(r->data, msg) != (adbus_ssize_t) msg->size;
+}
+
+/* -------------------------------------------------------------------------- */
+// Adds the remotes of the matching matches to the list of targets of the
+// message currently being dispatched from the remote 'from'
+static int DispatchList(adbus_Remote* from, struct Match* match, adbus_Message* msg)
+{
+    for (; match != NULL; match = match->il.next) {
+        int ret = CheckMatch(match, msg, &from->arena);
+        if (ret < 0)
+            return -1;
+        if (ret == 0)
             continue;
-        } else if (match->argumentsSize > 0) {
-            if (adbus_parseargs(msg))
-                return -1;
-            if (!ArgsMatch(match, msg))
-                continue;
-        }
 
-        return r->send(r->data, msg) != (adbus_ssize_t) msg->size;
+        adbus_Remote** pr = dv_push(Target, &from->targets, 1);
+        *pr = match->remote;
     }
     return 0;
 }
 
+static int DispatchIndex(
+        adbus_Remote*           from,
+        d_Hash(MatchIndex)*     h,
+        const char*             str,
+        size_t                  sz,
+        adbus_Message*          msg)
+{
+    if (str == NULL || dh_size(h) == 0)
+        return 0;
+
+    dh_strsz_t key = {str, sz};
+    dh_Iter ii = dh_get(MatchIndex, h, key);
+    if (ii == dh_end(h))
+        return 0;
+
+    return DispatchList(from, dh_val(h, ii)->matches.next, msg);
+}
+
+static int CompareTargets(const void* a, const void* b)
+{
+    adbus_Remote* ra = *(adbus_Remote* const*) a;
+    adbus_Remote* rb = *(adbus_Remote* const*) b;
+    return (ra > rb) - (ra < rb);
+}
+
 /* -------------------------------------------------------------------------- */
-int adbusI_serv_dispatch(adbus_Server* s, adbus_Message* m)
+int adbusI_serv_dispatch(adbus_Remote* from, adbus_Message* m)
 {
+    adbus_Server* s = from->server;
     adbus_Remote* direct = NULL;
     if (m->destination) {
         dh_Iter ii = dh_get(Service, &s->services, m->destination);
@@ -121,17 +261,41 @@ int adbusI_serv_dispatch(adbus_Server* s, adbus_Message* m)
         direct = s->busRemote;
     }
 
-    adbus_Remote* r;
-    DL_FOREACH(Remote, r, &s->remotes, hl) {
-        if (r != direct && RemoteDispatchMatch(r, m)) {
+    d_Vector(Target)* t = &from->targets;
+    dv_clear(Target, t);
+
+    if (    DispatchIndex(from, &s->memberMatches, m->member, m->memberSize, m)
+        ||  DispatchIndex(from, &s->interfaceMatches, m->interface, m->interfaceSize, m)
+        ||  DispatchIndex(from, &s->pathMatches, m->path, m->pathSize, m)
+        ||  DispatchIndex(from, &s->senderMatches, m->sender, m->senderSize, m)
+        ||  DispatchList(from, s->typeMatches[ADBUS_MSG_INVALID].next, m))
+    {
+        return -1;
+    }
+
+    if (m->type > ADBUS_MSG_INVALID && m->type <= ADBUS_MSG_SIGNAL) {
+        if (DispatchList(from, s->typeMatches[m->type].next, m))
             return -1;
-        }
     }
 
-    if (direct && direct->send(direct->data, m) != (adbus_ssize_t) m->size)
+    // A remote may have more than one matching match but should only get the
+    // message once. The direct remote always gets the message, so it is
+    // skipped here and sent to last.
+    size_t num = dv_size(t);
+    if (num > 1) {
+        qsort(dv_data(t), num, sizeof(adbus_Remote*), &CompareTargets);
+    }
+    for (size_t i = 0; i < num; i++) {
+        adbus_Remote* r = dv_a(t, i);
+        if (r == direct || (i > 0 && r == dv_a(t, i - 1)))
+            continue;
+        if (SendToRemote(r, m))
+            return -1;
+    }
+
+    if (direct && SendToRemote(direct, m))
         return -1;
 
     return 0;
 }
 
-
@@ -47,7 +47,22 @@ static void UnpackBuffer(adbus_Buffer* b, adbus_Message** m, char** data, size_t
 }
 
 /* -------------------------------------------------------------------------- */
-static int DispatchMsg(adbus_Remote* r, adbus_Buffer* b)
+// Messages to the bus itself (including the initial hello) modify the name
+// registry and match rules so need the exclusive lock. Everything else only
+// reads the server state and can be dispatched under the shared lock.
+static adbus_Bool NeedsExclusiveLock(adbus_Remote* r, adbus_Message* m)
+{
+    if (!r->haveHello)
+        return 1;
+
+    if (m->destination == NULL)
+        return m->type == ADBUS_MSG_METHOD;
+
+    return strcmp(m->destination, "org.freedesktop.DBus") == 0;
+}
+
+/* -------------------------------------------------------------------------- */
+static int DispatchMsg(adbus_Remote* r, adbus_Buffer* b, adbus_Bool lock)
 {
     adbus_Message* m;
     char* data;
@@ -59,11 +74,30 @@ static int DispatchMsg(adbus_Remote* r, adbus_Buffer* b)
     if (m->signature && !r->native && adbus_flip_data((char*) m->argdata, m->argsize, m->signature))
         return -1;
 
+    // Check all of the strings in the arguments before they are forwarded
+    // on to anyone else
+    if (m->signature && adbusI_validateData(m->argdata, m->argsize, m->signature))
+        return -1;
+
     if (ADBUS_TRACE_BUS) {
         adbusI_logmsg("dispatch", m);
     }
 
     adbus_Server* s = r->server;
+    adbus_Bool exclusive = NeedsExclusiveLock(r, m);
+
+    if (lock && exclusive) {
+        adbusI_serv_lock(s);
+    } else if (lock) {
+        adbusI_serv_lockshared(s);
+    }
+
+    int ret = -1;
+    adbus_SharedMsg* shared = NULL;
+
+    // The arguments for matching match rules are allocated from the arena
+    adbusI_arena_begin(&r->arena);
+    r->arenaMessages++;
 
     // If we haven't yet gotten a hello, we only accept a method call to the
     // hello method. This needs:
@@ -75,30 +109,65 @@ static int DispatchMsg(adbus_Remote* r, adbus_Buffer* b)
     // The arguments will be checked in the callback
     if (!r->haveHello) {
         if (m->type != ADBUS_MSG_METHOD)
-            return -1;
+            goto end;
         if (m->destination && strcmp(m->destination, "org.freedesktop.DBus") != 0)
-            return -1;
+            goto end;
         if (m->interface && strcmp(m->interface, "org.freedesktop.DBus") != 0)
-            return -1;
+            goto end;
         if (m->path == NULL || (strcmp(m->path, "/") != 0 && strcmp(m->path, "/org/freedesktop/DBus") != 0))
-            return -1;
+            goto end;
         if (m->member == NULL || strcmp(m->member, "Hello") != 0)
-            return -1;
+            goto end;
 
         assert(s->helloRemote == NULL);
         s->helloRemote = r;
     }
 
-    int ret = adbusI_serv_dispatch(r->server, m);
+    // The message is handed out to the send callbacks backed by a shared
+    // buffer pointing into b, so that callbacks which need to keep the
+    // message can take a ref rather than copying it.
+    shared = r->shared;
+    if (shared == NULL) {
+        shared = NEW(adbus_SharedMsg);
+        shared->ref = 1;
+        r->shared = shared;
+    }
+    shared->data = m->data;
+    shared->size = m->size;
+    m->shared    = shared;
+
+    ret = adbusI_serv_dispatch(r, m);
 
-    free(m->arguments);
-    adbus_buf_reset(b);
+end:
+    m->arguments     = NULL;
+    m->argumentsSize = 0;
+    adbusI_arena_end(&r->arena);
+
+    if (shared && shared->ref > 1) {
+        // Someone has kept a ref so they now own the buffer data. The
+        // adbus_Message header at the start of the buffer is not used after
+        // this.
+        shared->alloc = adbus_buf_release(b);
+        r->shared = NULL;
+        adbus_smsg_deref(shared);
+    } else {
+        adbus_buf_reset(b);
+    }
+
+    if (exclusive) {
+        s->helloRemote = NULL;
+    }
 
-    s->helloRemote   = NULL;
     r->msgSize       = 0;
     r->headerSize    = 0;
     r->parsedMsgSize = 0;
 
+    if (lock && exclusive) {
+        adbusI_serv_unlock(s);
+    } else if (lock) {
+        adbusI_serv_unlockshared(s);
+    }
+
     return ret;
 }
 
@@ -154,18 +223,13 @@ static int FixHeaders(adbus_Remote* r, adbus_Buffer* b)
     const char* arraybegin = i.data;
 
     while (adbus_iter_inarray(&i, &a)) {
-        adbus_IterVariant v;
         char* fieldbegin = (char*) i.data;
         const uint8_t* code;
         if (adbus_iter_beginstruct(&i))
             return -1;
         if (adbus_iter_u8(&i, &code))
             return -1;
-        if (adbus_iter_beginvariant(&i, &v))
-            return -1;
-        if (adbus_iter_value(&i))
-            return -1;
-        if (adbus_iter_endvariant(&i, &v))
+        if (adbusI_validateValue(&i))
             return -1;
         if (adbus_iter_endstruct(&i))
             return -1;
@@ -203,12 +267,7 @@ static int FixHeaders(adbus_Remote* r, adbus_Buffer* b)
 
 
 
-/** Dispatches a message from the given remote
- *  \relates adbus_Server
- *
- *  \return non-zero on error at which point the remote should be kicked
- */
-int adbus_remote_dispatch(adbus_Remote* r, adbus_Message* m)
+static int RemoteDispatch(adbus_Remote* r, adbus_Message* m, adbus_Bool lock)
 {
     assert(r->msgSize == r->parsedMsgSize && r->msgSize == r->headerSize && r->msgSize == 0);
 
@@ -222,9 +281,21 @@ int adbus_remote_dispatch(adbus_Remote* r, adbus_Message* m)
 
     adbus_buf_append(b, m->argdata, m->argsize);
 
-    return DispatchMsg(r, b);
+    return DispatchMsg(r, b, lock);
 }
 
+/** Dispatches a message from the given remote
+ *  \relates adbus_Server
+ *
+ *  \return non-zero on error at which point the remote should be kicked
+ */
+int adbus_remote_dispatch(adbus_Remote* r, adbus_Message* m)
+{ return RemoteDispatch(r, m, 1); }
+
+// Version of adbus_remote_dispatch used when the server lock is already held
+int adbusI_remote_dispatch(adbus_Remote* r, adbus_Message* m)
+{ return RemoteDispatch(r, m, 0); }
+
 
 
 
@@ -288,10 +359,22 @@ int adbus_remote_parse(adbus_Remote* r, adbus_Buffer* b)
                     // Copy header
                     adbusI_ExtendedHeader* h = (adbusI_ExtendedHeader*) data;
 
-                    size_t hsize    = sizeof(adbusI_ExtendedHeader)
-                        + Get32(h->endianness, &h->headerFieldLength);
+                    // Check the lengths before we reserve any space for the
+                    // message, since they come straight from the remote
+                    uint32_t fieldsz = Get32(h->endianness, &h->headerFieldLength);
+                    uint32_t bodysz  = Get32(h->endianness, &h->length);
+                    if (    fieldsz > ADBUSI_MAXIMUM_MESSAGE_LENGTH
+                        ||  bodysz > ADBUSI_MAXIMUM_MESSAGE_LENGTH)
+                    {
+                        return -1;
+                    }
+
+                    size_t hsize    = sizeof(adbusI_ExtendedHeader) + fieldsz;
                     r->headerSize   = ADBUSI_ALIGN(hsize, 8);
-                    r->msgSize      = r->headerSize + Get32(h->endianness, &h->length);
+                    r->msgSize      = r->headerSize + bodysz;
+
+                    if (r->msgSize > ADBUSI_MAXIMUM_MESSAGE_LENGTH)
+                        return -1;
 
                     InitBuffer(r->msg);
 
@@ -315,6 +398,10 @@ int adbus_remote_parse(adbus_Remote* r, adbus_Buffer* b)
                     if (FixHeaders(r, r->msg))
                         return -1;
 
+                    // Size the message buffer for the whole message so the
+                    // body is copied in once without regrowing
+                    adbus_buf_reserve(r->msg, ADBUS_ALIGN(sizeof(adbus_Message), 8) + r->parsedMsgSize);
+
                     // fall through
                 }
 
@@ -332,7 +419,7 @@ int adbus_remote_parse(adbus_Remote* r, adbus_Buffer* b)
                     if (need > 0 && Move(r->msg, &data, &size, need))
                         goto end;
 
-                    if (DispatchMsg(r, r->msg))
+                    if (DispatchMsg(r, r->msg, 1))
                         return -1;
 
                     // loop around
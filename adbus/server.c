@@ -29,7 +29,7 @@
 /** \struct adbus_Server
  *  \brief Bus server
  *
- *  The provided bus server is a minimal single threaded server. The server by
+ *  The provided bus server is a minimal server. The server by
  *  default provides the following members of the "org.freedesktop.DBus"
  *  interface on the "/" and "/org/freedesktop/DBus" paths:
  *  - Hello
@@ -57,6 +57,20 @@
  *  adbus_remote_parse() to dispatch.
  *  -# When the remote disconnects call adbus_remote_disconnect() to cleanup.
  *
+ *  By default the server is single threaded. To service remotes from
+ *  multiple threads (eg one thread per group of sockets doing its own reading,
+ *  auth and parsing), install a reader/writer lock with adbus_serv_setlock().
+ *  Messages routed between remotes are dispatched with the lock shared, so
+ *  workers can dispatch in parallel. Connecting, disconnecting and messages
+ *  to the bus itself (eg RequestName and AddMatch) take the lock exclusively.
+ *  The send callbacks are called with the lock held, so they may be called on
+ *  any thread and must not call back into the server. They should generally
+ *  queue the message (adbus_msg_share()) for the thread that owns the remote.
+ *  With a shared lock the send callback of a remote may be called by more than
+ *  one worker at the same time. Remotes that queue messages
+ *  (adbus_remote_setqueue()) then also need a lock for the queue, see
+ *  adbus_remote_setqueuelock().
+ *
  */
 
 /** \struct adbus_Remote
@@ -102,11 +116,89 @@ void adbus_serv_free(adbus_Server* s)
     dh_clear(Service, &s->services);
 
     dh_free(Service, &s->services);
+    adbusI_serv_freematches(s);
     adbusI_serv_freebus(s);
     adbus_iface_deref(s->busInterface);
     free(s);
 }
 
+/** Sets the reader/writer lock used to protect the server state
+ *  \relates adbus_Server
+ *
+ *  All of the callbacks are called with \a user. \a lock and \a unlock take
+ *  and release the lock exclusively. \a lockshared and \a unlockshared take
+ *  and release the lock shared (eg pthread_rwlock_rdlock). The lock does not
+ *  need to be recursive.
+ *
+ *  \a lockshared and \a unlockshared may be NULL in which case \a lock and
+ *  \a unlock must provide a mutex and all dispatches are serialised.
+ *
+ *  This should be set before any remotes are connected.
+ */
+void adbus_serv_setlock(
+        adbus_Server*   s,
+        adbus_Callback  lock,
+        adbus_Callback  unlock,
+        adbus_Callback  lockshared,
+        adbus_Callback  unlockshared,
+        void*           user)
+{
+    assert((lockshared == NULL) == (unlockshared == NULL));
+    s->lock         = lock;
+    s->unlock       = unlock;
+    s->lockShared   = lockshared;
+    s->unlockShared = unlockshared;
+    s->lockData     = user;
+}
+
+/** Enables or disables the per message scratch arenas
+ *  \relates adbus_Server
+ *
+ *  This sets up the arena used for the argument arrays when matching match
+ *  rules and the arena of the bus connection (see adbus_conn_setarena()).
+ *  This should be set before any remotes are connected.
+ */
+void adbus_serv_setarena(adbus_Server* s, adbus_Bool enable)
+{
+    adbusI_serv_lock(s);
+    s->arenaEnabled = enable;
+    for (adbus_Remote* r = s->remotes.next; r != NULL; r = r->hl.next) {
+        adbusI_arena_enable(&r->arena, enable);
+    }
+    adbus_conn_setarena(s->busConnection, enable);
+    adbusI_serv_unlock(s);
+}
+
+/** Gets statistics on the per message scratch allocations
+ *  \relates adbus_Server
+ *
+ *  \param[in]  s           The server.
+ *  \param[out] messages    Number of messages dispatched.
+ *  \param[out] mallocs     Number of heap allocations made for scratch space,
+ *                          including by the bus connection.
+ *
+ *  The outputs may be NULL if that value is not needed.
+ */
+void adbus_serv_arenastats(adbus_Server* s, size_t* messages, size_t* mallocs)
+{
+    size_t busmallocs;
+    adbusI_serv_lock(s);
+    adbus_conn_arenastats(s->busConnection, NULL, &busmallocs);
+
+    size_t msgs = s->arenaMessages;
+    size_t allocs = s->arenaMallocs + busmallocs;
+    for (adbus_Remote* r = s->remotes.next; r != NULL; r = r->hl.next) {
+        msgs += r->arenaMessages;
+        allocs += r->arena.mallocs;
+    }
+
+    if (messages)
+        *messages = msgs;
+    if (mallocs)
+        *mallocs = allocs;
+    adbusI_serv_unlock(s);
+}
+
 /** Adds a new remote to the server
  *  \relates adbus_Server
  *
@@ -125,6 +217,10 @@ adbus_Remote* adbus_serv_connect(
     r->msg          = adbus_buf_new();
     r->dispatch     = adbus_buf_new();
 
+    adbusI_serv_lock(s);
+
+    adbusI_arena_enable(&r->arena, s->arenaEnabled);
+
     if (s->busRemote == NULL) {
         ds_set(&r->unique, "org.freedesktop.DBus");
     } else {
@@ -133,6 +229,8 @@ adbus_Remote* adbus_serv_connect(
 
     dl_insert_after(Remote, &s->remotes, r, &r->hl);
 
+    adbusI_serv_unlock(s);
+
     return r;
 }
 
@@ -146,12 +244,15 @@ void adbus_remote_disconnect(adbus_Remote* r)
 
     adbus_Server* s = r->server;
 
+    adbusI_serv_lock(s);
+
     dl_remove(Remote, r, &r->hl);
 
     // Free the matches
     struct Match* m = r->matches.next;
     while (m) {
         struct Match* next = m->hl.next;
+        adbusI_serv_removematch(s, m);
         adbusI_serv_freematch(m);
         m = next;
     }
@@ -162,13 +263,96 @@ void adbus_remote_disconnect(adbus_Remote* r)
     }
     dv_free(Service, &r->services);
 
+    s->arenaMessages += r->arenaMessages;
+    s->arenaMallocs += r->arena.mallocs;
+
+    adbusI_serv_unlock(s);
 
+    adbusI_arena_free(&r->arena);
+    dv_free(Target, &r->targets);
+    adbusI_queue_free(&r->queue);
+    adbus_smsg_deref(r->shared);
     adbus_buf_free(r->msg);
     adbus_buf_free(r->dispatch);
     ds_free(&r->unique);
     free(r);
 }
 
+/** Enables or disables queueing of messages sent to the remote
+ *  \relates adbus_Server
+ *
+ *  When enabled, messages are queued instead of being sent via the send
+ *  callback given to adbus_serv_connect(). The queue is sent with a single
+ *  call to \a send when the queued data reaches \a threshold bytes or on
+ *  adbus_remote_flush(). The queued messages share their data with the other
+ *  remotes the message was sent to.
+ *
+ *  A threshold of 0 flushes any queued messages and disables queueing.
+ */
+void adbus_remote_setqueue(
+        adbus_Remote*           r,
+        adbus_SendMsgsCallback  send,
+        size_t                  threshold)
+{
+    assert(threshold == 0 || send);
+
+    adbus_Server* s = r->server;
+    assert(threshold == 0 || !s->lockShared || r->queueLock);
+
+    adbusI_serv_lock(s);
+
+    if (threshold == 0) {
+        adbusI_queue_flush(&r->queue, r->sendmsgs, r->data);
+    }
+
+    r->sendmsgs         = send;
+    r->queue.threshold  = threshold;
+
+    adbusI_serv_unlock(s);
+}
+
+/** Sets the lock used to protect the remote's send queue
+ *  \relates adbus_Server
+ *
+ *  When the server has a shared lock (see adbus_serv_setlock()) more than one
+ *  worker may queue messages for the remote at the same time. \a lock and \a
+ *  unlock are then called with \a user around each use of the queue,
+ *  including the call to the adbus_SendMsgsCallback when the queue is sent.
+ *  They must provide a mutex (it does not need to be recursive).
+ *
+ *  This must be set before enabling queueing with adbus_remote_setqueue(). It
+ *  is not needed if the server has no shared lock.
+ */
+void adbus_remote_setqueuelock(
+        adbus_Remote*   r,
+        adbus_Callback  lock,
+        adbus_Callback  unlock,
+        void*           user)
+{
+    adbus_Server* s = r->server;
+    adbusI_serv_lock(s);
+    r->queueLock     = lock;
+    r->queueUnlock   = unlock;
+    r->queueLockData = user;
+    adbusI_serv_unlock(s);
+}
+
+/** Sends any queued messages
+ *  \relates adbus_Server
+ *
+ *  \return non-zero on error at which point the remote should be kicked
+ */
+int adbus_remote_flush(adbus_Remote* r)
+{
+    adbus_Server* s = r->server;
+    adbusI_serv_lockshared(s);
+    adbusI_remote_lockqueue(r);
+    int ret = adbusI_queue_flush(&r->queue, r->sendmsgs, r->data);
+    adbusI_remote_unlockqueue(r);
+    adbusI_serv_unlockshared(s);
+    return ret;
+}
+
 /* -------------------------------------------------------------------------- */
 adbus_Remote* adbusI_serv_remote(adbus_Server* s, const char* name)
 {
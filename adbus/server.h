@@ -37,6 +37,7 @@
 
 struct Match;
 struct MatchArgument;
+struct MatchIndex;
 struct Service;
 struct ServiceOwner;
 
@@ -57,6 +58,11 @@ struct Match
 {
     d_List(Match)           hl;
 
+    // Link into the server's match index (see struct MatchIndex)
+    d_List(Match)           il;
+    adbus_Remote*           remote;
+    struct MatchIndex*      index;
+
     adbus_MessageType       type;
     uint32_t                reply;
     adbus_Bool              checkReply;
@@ -82,6 +88,21 @@ struct Match
 
 /* -------------------------------------------------------------------------- */
 
+// Matches are indexed on the server by the most selective field they set
+// (member, then interface, path, sender). Matches with none of those set are
+// kept in a per type list. Each bucket owns a copy of its key, since the
+// match that created the bucket may be removed before the others.
+struct MatchIndex
+{
+    d_List(Match)           matches;
+    dh_strsz_t              key;
+    char                    data[1];
+};
+
+DHASH_MAP_INIT_STRSZ(MatchIndex, struct MatchIndex*);
+
+/* -------------------------------------------------------------------------- */
+
 struct ServiceOwner
 {
     adbus_Remote*           remote;
@@ -100,6 +121,7 @@ struct Service
 
 DHASH_MAP_INIT_STR(Service, struct Service*);
 DVECTOR_INIT(Service, struct Service*);
+DVECTOR_INIT(Target, adbus_Remote*);
 
 /* -------------------------------------------------------------------------- */
 
@@ -119,12 +141,24 @@ struct adbus_Remote
     d_List(Match)           matches;
 
     adbus_SendMsgCallback   send;
+    adbus_SendMsgsCallback  sendmsgs;
     void*                   data;
+    adbusI_SendQueue        queue;
+
+    // Optional lock around the queue, needed when messages are dispatched
+    // under the shared server lock as then more than one worker may be
+    // queueing messages for this remote at the same time
+    adbus_Callback          queueLock;
+    adbus_Callback          queueUnlock;
+    void*                   queueLockData;
 
     enum ParseState         parseState;
     adbus_Buffer*           msg;
     adbus_Buffer*           dispatch;
     adbus_Bool              native;
+    // Shared buffer used to hand out refs to the message being dispatched.
+    // This is kept around for the next message if no refs are taken.
+    adbus_SharedMsg*        shared;
     size_t                  headerSize;
     size_t                  msgSize;
     size_t                  parsedMsgSize;
@@ -134,6 +168,13 @@ struct adbus_Remote
     adbus_Bool              haveHello;
 
     d_Vector(Service)       services;
+
+    // Scratch space for the message currently being dispatched from this
+    // remote and the remotes it is to be sent to. These are per remote so
+    // that workers can dispatch under the shared lock.
+    adbusI_Arena            arena;
+    size_t                  arenaMessages;
+    d_Vector(Target)        targets;
 };
 
 DHASH_MAP_INIT_STR(Remote, adbus_Remote*);
@@ -154,20 +195,87 @@ struct adbus_Server
     d_List(Remote)          remotes;
 
     unsigned int            nextRemote;
+
+    // Optional reader/writer lock used to protect the server state when
+    // remotes are serviced from multiple threads (see adbus_serv_setlock)
+    adbus_Callback          lock;
+    adbus_Callback          unlock;
+    adbus_Callback          lockShared;
+    adbus_Callback          unlockShared;
+    void*                   lockData;
+
+    d_Hash(MatchIndex)      memberMatches;
+    d_Hash(MatchIndex)      interfaceMatches;
+    d_Hash(MatchIndex)      pathMatches;
+    d_Hash(MatchIndex)      senderMatches;
+    d_List(Match)           typeMatches[ADBUS_MSG_SIGNAL + 1];
+
+    // Whether the remotes use arenas and the arena statistics of remotes
+    // that have since disconnected
+    adbus_Bool              arenaEnabled;
+    size_t                  arenaMessages;
+    size_t                  arenaMallocs;
 };
 
 /* -------------------------------------------------------------------------- */
 
+ADBUS_INLINE void adbusI_serv_lock(adbus_Server* s)
+{
+    if (s->lock)
+        s->lock(s->lockData);
+}
+
+ADBUS_INLINE void adbusI_serv_unlock(adbus_Server* s)
+{
+    if (s->unlock)
+        s->unlock(s->lockData);
+}
+
+// Falls back to the exclusive lock if no shared lock has been provided
+ADBUS_INLINE void adbusI_serv_lockshared(adbus_Server* s)
+{
+    if (s->lockShared)
+        s->lockShared(s->lockData);
+    else
+        adbusI_serv_lock(s);
+}
+
+ADBUS_INLINE void adbusI_serv_unlockshared(adbus_Server* s)
+{
+    if (s->unlockShared)
+        s->unlockShared(s->lockData);
+    else
+        adbusI_serv_unlock(s);
+}
+
+ADBUS_INLINE void adbusI_remote_lockqueue(adbus_Remote* r)
+{
+    if (r->queueLock)
+        r->queueLock(r->queueLockData);
+}
+
+ADBUS_INLINE void adbusI_remote_unlockqueue(adbus_Remote* r)
+{
+    if (r->queueUnlock)
+        r->queueUnlock(r->queueLockData);
+}
+
+/* -------------------------------------------------------------------------- */
+
 adbus_Remote* adbusI_serv_remote(adbus_Server* s, const char* name);
 struct Match* adbusI_serv_newmatch(const char* mstr, size_t len);
 void adbusI_serv_freematch(struct Match* m);
+void adbusI_serv_addmatch(adbus_Server* s, adbus_Remote* r, struct Match* m);
+void adbusI_serv_removematch(adbus_Server* s, struct Match* m);
+void adbusI_serv_freematches(adbus_Server* s);
 int  adbusI_serv_requestname(adbus_Server* s, adbus_Remote* r, const char* name, uint32_t flags);
 int  adbusI_serv_releasename(adbus_Server* s, adbus_Remote* r, const char* name);
 void adbusI_serv_freeservice(struct Service* s);
-int  adbusI_serv_dispatch(adbus_Server* s, adbus_Message* m);
+int  adbusI_serv_dispatch(adbus_Remote* from, adbus_Message* m);
 void adbusI_serv_initbus(adbus_Server* s);
 void adbusI_serv_freebus(adbus_Server* s);
 void adbusI_serv_ownerchanged(adbus_Server* s, const char* name, adbus_Remote* o, adbus_Remote* n);
 void adbusI_serv_removeServiceFromRemote(adbus_Remote* r, struct Service* serv);
+int  adbusI_remote_dispatch(adbus_Remote* r, adbus_Message* m);
 
 
@@ -39,6 +39,10 @@
  *  \note If there are no arguments a single call to adbus_sig_emit() will
  *  suffice.
  *
+ *  The arguments are only serialised once per emit. For each bind only the
+ *  header is rebuilt (from a template of the fields common to every bind)
+ *  and written directly in front of the arguments.
+ *
  *  For example:
  *  \code
  *  void EmitSignal()
@@ -68,6 +72,11 @@ struct adbus_Signal
     adbus_MsgFactory*   message;
     d_Vector(Bind)      binds;
     adbus_Member*       member;
+
+    // Header fields shared by all binds (interface, member, signature)
+    adbus_Buffer*       fields;
+    // Message being sent - header followed by the arguments
+    adbus_Buffer*       send;
 };
 
 /* ------------------------------------------------------------------------- */
@@ -79,7 +88,9 @@ adbus_Signal* adbus_sig_new(adbus_Member* mbr)
 {
     adbus_Signal* s = NEW(adbus_Signal);
     s->message  = adbus_msg_new();
-    s->member = mbr;
+    s->fields   = adbus_buf_new();
+    s->send     = adbus_buf_new();
+    s->member   = mbr;
     adbus_iface_ref(mbr->interface);
     return s;
 }
@@ -94,6 +105,9 @@ void adbus_sig_free(adbus_Signal* s)
     if (s) {
         adbus_sig_reset(s);
         dv_free(Bind, &s->binds);
+        adbus_msg_free(s->message);
+        adbus_buf_free(s->fields);
+        adbus_buf_free(s->send);
         adbus_iface_deref(s->member->interface);
         free(s);
     }
@@ -106,7 +120,6 @@ void adbus_sig_free(adbus_Signal* s)
  */
 void adbus_sig_reset(adbus_Signal* s)
 {
-    adbus_msg_free(s->message);
     for (size_t i = 0; i < dv_size(&s->binds); i++) {
         free(dv_a(&s->binds, i).path);
     }
@@ -150,6 +163,58 @@ adbus_MsgFactory* adbus_sig_msg(adbus_Signal* s)
 
 /* ------------------------------------------------------------------------- */
 
+static void AppendField(adbus_Buffer* b, uint8_t code, const char* type, const char* str, size_t size)
+{
+    adbus_BufVariant v;
+    adbus_buf_appendsig(b, "(yv)", 4);
+    adbus_buf_beginstruct(b);
+    adbus_buf_u8(b, code);
+    adbus_buf_beginvariant(b, &v, type, 1);
+    if (*type == 'g') {
+        adbus_buf_signature(b, str, (int) size);
+    } else {
+        adbus_buf_string(b, str, (int) size);
+    }
+    adbus_buf_endvariant(b, &v);
+    adbus_buf_endstruct(b);
+}
+
+// Size of the path header field including the padding to the next field
+#define PATH_FIELD_SIZE(pathSize) ADBUSI_ALIGN(8 + (pathSize) + 1, 8)
+
+// Writes the header for bind b so that it ends at dest + hsize
+static void WriteHeader(adbus_Signal* s, struct Bind* b, char* dest, size_t hsize, size_t argsize)
+{
+    size_t fieldsSize = adbus_buf_size(s->fields);
+    size_t pathField = PATH_FIELD_SIZE(b->pathSize);
+
+    adbusI_ExtendedHeader* h = (adbusI_ExtendedHeader*) dest;
+    h->endianness           = adbusI_nativeEndianness();
+    h->type                 = ADBUS_MSG_SIGNAL;
+    h->flags                = ADBUS_MSG_NO_REPLY;
+    h->version              = adbusI_majorProtocolVersion;
+    h->length               = (uint32_t) argsize;
+    h->serial               = adbus_conn_serial(b->connection);
+    h->headerFieldLength    = (uint32_t) (pathField + fieldsSize);
+
+    // The header array starts at offset 16 so is already 8 byte aligned
+    char* p = dest + sizeof(adbusI_ExtendedHeader);
+    uint32_t pathSize = (uint32_t) b->pathSize;
+    p[0] = HEADER_OBJECT_PATH;
+    p[1] = 1;
+    p[2] = 'o';
+    p[3] = '\0';
+    memcpy(p + 4, &pathSize, 4);
+    memcpy(p + 8, b->path, b->pathSize + 1);
+    memset(p + 8 + b->pathSize + 1, 0, pathField - 8 - b->pathSize - 1);
+    p += pathField;
+
+    memcpy(p, adbus_buf_data(s->fields), fieldsSize);
+    p += fieldsSize;
+
+    memset(p, 0, dest + hsize - p);
+}
+
 /** Emits the signal on all bound path/connection combos.
  *  \relates adbus_Signal
  *
@@ -160,27 +225,73 @@ void adbus_sig_emit(adbus_Signal* s)
 {
     adbus_MsgFactory* m = s->message;
     adbus_Interface* i = s->member->interface;
+    adbus_Buffer* argbuf = adbus_msg_argbuffer(m);
 
     adbus_msg_end(m);
-    adbus_msg_setmember(m, s->member->name.str, s->member->name.sz);
-    adbus_msg_setinterface(m, i->name.str, i->name.sz);
 
-    for (size_t i = 0; i < dv_size(&s->binds); i++) {
-        struct Bind* b = &dv_a(&s->binds, i);
+    size_t argsize = adbus_buf_size(argbuf);
+    size_t sigsize;
+    const char* sig = adbus_buf_sig(argbuf, &sigsize);
+
+    // Build the header fields common to all binds
+    adbus_buf_reset(s->fields);
+    AppendField(s->fields, HEADER_INTERFACE, "s", i->name.str, i->name.sz);
+    AppendField(s->fields, HEADER_MEMBER, "s", s->member->name.str, s->member->name.sz);
+    if (argsize > 0) {
+        AppendField(s->fields, HEADER_SIGNATURE, "g", sig, sigsize);
+    }
+
+    // The arguments are copied in once after enough space for the largest
+    // header. Each header is then written so that it ends directly before
+    // the arguments.
+    size_t maxpath = 0;
+    for (size_t j = 0; j < dv_size(&s->binds); j++) {
+        if (dv_a(&s->binds, j).pathSize > maxpath) {
+            maxpath = dv_a(&s->binds, j).pathSize;
+        }
+    }
+
+    size_t maxheader = ADBUSI_ALIGN(sizeof(adbusI_ExtendedHeader)
+                                    + PATH_FIELD_SIZE(maxpath)
+                                    + adbus_buf_size(s->fields), 8);
 
-        adbus_Connection* c = b->connection;
+    adbus_buf_reset(s->send);
+    adbusI_buf_push(s->send, maxheader);
+    adbus_buf_append(s->send, adbus_buf_data(argbuf), argsize);
+    char* args = adbus_buf_data(s->send) + maxheader;
 
-        adbus_msg_settype(m, ADBUS_MSG_SIGNAL);
-        adbus_msg_setflags(m, ADBUS_MSG_NO_REPLY);
-        adbus_msg_setserial(m, adbus_conn_serial(c));
-        adbus_msg_setpath(m, b->path, b->pathSize);
+    for (size_t j = 0; j < dv_size(&s->binds); j++) {
+        struct Bind* b = &dv_a(&s->binds, j);
 
-        adbus_msg_send(m, c);
+        size_t hsize = ADBUSI_ALIGN(sizeof(adbusI_ExtendedHeader)
+                                    + PATH_FIELD_SIZE(b->pathSize)
+                                    + adbus_buf_size(s->fields), 8);
+
+        WriteHeader(s, b, args - hsize, hsize, argsize);
+
+        adbus_Message msg;
+        ZERO(&msg);
+        msg.data            = args - hsize;
+        msg.size            = hsize + argsize;
+        msg.argdata         = args;
+        msg.argsize         = argsize;
+        msg.type            = ADBUS_MSG_SIGNAL;
+        msg.flags           = ADBUS_MSG_NO_REPLY;
+        msg.serial          = ((adbusI_ExtendedHeader*) msg.data)->serial;
+        msg.path            = b->path;
+        msg.pathSize        = b->pathSize;
+        msg.interface       = i->name.str;
+        msg.interfaceSize   = i->name.sz;
+        msg.member          = s->member->name.str;
+        msg.memberSize      = s->member->name.sz;
+        if (argsize > 0) {
+            msg.signature       = sig;
+            msg.signatureSize   = sigsize;
+        }
+
+        adbus_conn_send(b->connection, &msg);
     }
 
     // Reset the message
     adbus_sig_msg(s);
 }
-
-
-
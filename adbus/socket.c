@@ -35,12 +35,16 @@
 #   include <sys/types.h>
 #   include <sys/un.h>
 #   include <netdb.h>
+#   include <poll.h>
 #   include <unistd.h>
 #endif
 
+#include <errno.h>
 #include <string.h>
 
-#ifndef _WIN32
+#ifdef _WIN32
+#   define poll(fds, num, timeout) WSAPoll(fds, num, timeout)
+#else
 #   define closesocket(x) close(x)
 #endif
 
@@ -632,3 +636,37 @@ int adbus_sock_cauth(adbus_Socket sock, adbus_Buffer* buffer)
     return 0;
 }
 
+// ----------------------------------------------------------------------------
+
+#define BLOCK_RECV_SIZE (64 * 1024)
+
+/* Waits up to timeoutms (or forever if negative) for the socket to become
+ * readable and then reads what is available into the buffer.
+ *
+ * Returns the number of bytes read, 0 if the wait timed out or was
+ * interrupted, and -1 on error or if the remote end has closed the socket.
+ */
+adbus_ssize_t adbusI_sock_recv(adbus_Socket sock, adbus_Buffer* buf, int timeoutms)
+{
+    struct pollfd fd;
+    fd.fd       = sock;
+    fd.events   = POLLIN;
+    fd.revents  = 0;
+
+    int ready = poll(&fd, 1, timeoutms);
+    if (ready < 0) {
+#ifndef _WIN32
+        if (errno == EINTR)
+            return 0;
+#endif
+        return -1;
+    } else if (ready == 0) {
+        return 0;
+    }
+
+    char* dest = adbus_buf_recvbuf(buf, BLOCK_RECV_SIZE);
+    adbus_ssize_t recvd = recv(sock, dest, BLOCK_RECV_SIZE, 0);
+    adbus_buf_recvd(buf, BLOCK_RECV_SIZE, recvd);
+
+    return recvd > 0 ? recvd : -1;
+}
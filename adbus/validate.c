@@ -0,0 +1,451 @@
+/* vim: ts=4 sw=4 sts=4 et
+ *
+ * Copyright (c) 2009 James R. McKaskill
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * ----------------------------------------------------------------------------
+ */
+
+#define ADBUS_LIBRARY
+#include "misc.h"
+
+/* --------------------------------------------------------------------------
+ * Validation of names, object paths and UTF-8 strings.
+ *
+ * All of the names are made up of elements of [A-Za-z0-9_] (and '-' for bus
+ * names) separated by a single separator character. The bulk of the work is
+ * finding the bytes outside of the element character set, which is done a
+ * block at a time using SSE2 or AVX2 when available. The (few) bytes found
+ * are then checked one at a time to make sure they are correctly placed
+ * separators.
+ *
+ * Strings are checked for valid UTF-8 by skipping over runs of ASCII a block
+ * at a time and then decoding any multibyte sequences one at a time.
+ *
+ * The AVX2 kernels are compiled separately using the target attribute and
+ * are only used if the CPU supports them. Otherwise the SSE2 kernels are used
+ * if the compiler targets SSE2, and failing that a scalar fallback.
+ */
+
+#ifdef ADBUSI_HAVE_SSE2
+#   include <emmintrin.h>
+#endif
+
+#ifdef ADBUSI_HAVE_AVX2
+#   include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#   include <intrin.h>
+static int Ctz(uint32_t v)
+{
+    unsigned long i;
+    _BitScanForward(&i, v);
+    return (int) i;
+}
+#elif defined __GNUC__
+#   define Ctz(v) __builtin_ctz(v)
+#else
+static int Ctz(uint32_t v)
+{
+    int i = 0;
+    while (!(v & 1)) {
+        v >>= 1;
+        i++;
+    }
+    return i;
+}
+#endif
+
+struct Kernels
+{
+    // Number of bytes processed by nonword
+    size_t      block;
+    // Returns a mask of the bytes in the block not in [A-Za-z0-9_] (or '-'
+    // if dash is set)
+    uint32_t    (*nonword)(const char* p, adbus_Bool dash);
+    // Returns the number of leading bytes which are known to be ASCII. This
+    // may be less than the actual number.
+    size_t      (*ascii)(const char* p, size_t len);
+};
+
+ADBUS_INLINE adbus_Bool IsDigit(char c)
+{ return '0' <= c && c <= '9'; }
+
+ADBUS_INLINE adbus_Bool IsWord(char c, adbus_Bool dash)
+{
+    return ('a' <= c && c <= 'z')
+        || ('A' <= c && c <= 'Z')
+        || ('0' <= c && c <= '9')
+        || c == '_'
+        || (dash && c == '-');
+}
+
+// ----------------------------------------------------------------------------
+
+#ifndef ADBUSI_HAVE_SSE2
+static size_t AsciiScalar(const char* p, size_t len)
+{
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, p + i, 8);
+        if (w & UINT64_C(0x8080808080808080))
+            break;
+    }
+    return i;
+}
+
+static const struct Kernels sScalar = {0, NULL, &AsciiScalar};
+#endif
+
+// ----------------------------------------------------------------------------
+
+#ifdef ADBUSI_HAVE_SSE2
+// The range checks bias the value so that the range starts at -128 and then
+// use a signed compare, as SSE2 only has signed byte compares.
+#define SSE2_IN_RANGE(x, lo, hi) \
+    _mm_cmpgt_epi8( \
+            _mm_set1_epi8((char) (-128 + (hi) - (lo) + 1)), \
+            _mm_add_epi8(x, _mm_set1_epi8((char) (0x80 - (lo)))))
+
+static uint32_t NonWordSSE2(const char* p, adbus_Bool dash)
+{
+    __m128i x       = _mm_loadu_si128((const __m128i*) p);
+    __m128i lower   = _mm_or_si128(x, _mm_set1_epi8(0x20));
+    __m128i word    = _mm_or_si128(
+            _mm_or_si128(SSE2_IN_RANGE(lower, 'a', 'z'), SSE2_IN_RANGE(x, '0', '9')),
+            _mm_cmpeq_epi8(x, _mm_set1_epi8('_')));
+    if (dash) {
+        word = _mm_or_si128(word, _mm_cmpeq_epi8(x, _mm_set1_epi8('-')));
+    }
+    return ~(uint32_t) _mm_movemask_epi8(word) & 0xFFFF;
+}
+
+static size_t AsciiSSE2(const char* p, size_t len)
+{
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64) {
+        __m128i x0 = _mm_loadu_si128((const __m128i*) (p + i));
+        __m128i x1 = _mm_loadu_si128((const __m128i*) (p + i + 16));
+        __m128i x2 = _mm_loadu_si128((const __m128i*) (p + i + 32));
+        __m128i x3 = _mm_loadu_si128((const __m128i*) (p + i + 48));
+        __m128i x  = _mm_or_si128(_mm_or_si128(x0, x1), _mm_or_si128(x2, x3));
+        if (_mm_movemask_epi8(x))
+            break;
+    }
+    for (; i + 16 <= len; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*) (p + i));
+        uint32_t mask = (uint32_t) _mm_movemask_epi8(x);
+        if (mask)
+            return i + Ctz(mask);
+    }
+    return i;
+}
+
+static const struct Kernels sSSE2 = {16, &NonWordSSE2, &AsciiSSE2};
+#endif
+
+// ----------------------------------------------------------------------------
+
+#ifdef ADBUSI_HAVE_AVX2
+#define AVX2_IN_RANGE(x, lo, hi) \
+    _mm256_cmpgt_epi8( \
+            _mm256_set1_epi8((char) (-128 + (hi) - (lo) + 1)), \
+            _mm256_add_epi8(x, _mm256_set1_epi8((char) (0x80 - (lo)))))
+
+__attribute__((target("avx2")))
+static uint32_t NonWordAVX2(const char* p, adbus_Bool dash)
+{
+    __m256i x       = _mm256_loadu_si256((const __m256i*) p);
+    __m256i lower   = _mm256_or_si256(x, _mm256_set1_epi8(0x20));
+    __m256i word    = _mm256_or_si256(
+            _mm256_or_si256(AVX2_IN_RANGE(lower, 'a', 'z'), AVX2_IN_RANGE(x, '0', '9')),
+            _mm256_cmpeq_epi8(x, _mm256_set1_epi8('_')));
+    if (dash) {
+        word = _mm256_or_si256(word, _mm256_cmpeq_epi8(x, _mm256_set1_epi8('-')));
+    }
+    return ~(uint32_t) _mm256_movemask_epi8(word);
+}
+
+__attribute__((target("avx2")))
+static size_t AsciiAVX2(const char* p, size_t len)
+{
+    size_t i = 0;
+    for (; i + 128 <= len; i += 128) {
+        __m256i x0 = _mm256_loadu_si256((const __m256i*) (p + i));
+        __m256i x1 = _mm256_loadu_si256((const __m256i*) (p + i + 32));
+        __m256i x2 = _mm256_loadu_si256((const __m256i*) (p + i + 64));
+        __m256i x3 = _mm256_loadu_si256((const __m256i*) (p + i + 96));
+        __m256i x  = _mm256_or_si256(_mm256_or_si256(x0, x1), _mm256_or_si256(x2, x3));
+        if (_mm256_movemask_epi8(x))
+            break;
+    }
+    for (; i + 32 <= len; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i*) (p + i));
+        uint32_t mask = (uint32_t) _mm256_movemask_epi8(x);
+        if (mask)
+            return i + Ctz(mask);
+    }
+    return i;
+}
+
+static const struct Kernels sAVX2 = {32, &NonWordAVX2, &AsciiAVX2};
+#endif
+
+// ----------------------------------------------------------------------------
+
+ADBUS_INLINE const struct Kernels* GetKernels(void)
+{
+#ifdef ADBUSI_HAVE_AVX2
+    if (adbusI_cpuHasAVX2())
+        return &sAVX2;
+#endif
+#ifdef ADBUSI_HAVE_SSE2
+    return &sSSE2;
+#else
+    return &sScalar;
+#endif
+}
+
+// ----------------------------------------------------------------------------
+
+// Checks that the non element character at p is a separator between two
+// non-empty elements
+ADBUS_INLINE int Separator(const char* str, size_t len, size_t p, char sep, adbus_Bool nodigit, size_t* start)
+{
+    if (sep == '\0' || str[p] != sep || p == *start || p + 1 == len)
+        return -1;
+    if (nodigit && IsDigit(str[p + 1]))
+        return -1;
+
+    *start = p + 1;
+    return 0;
+}
+
+// Checks that str is made up of one or more non-empty elements separated by
+// sep. If nodigit is set then elements may not begin with a digit.
+//
+// Returns the number of separators or -1 if invalid.
+static int CheckElements(const char* str, size_t len, char sep, adbus_Bool dash, adbus_Bool nodigit)
+{
+    const struct Kernels* k = GetKernels();
+    size_t start = 0;
+    size_t i = 0;
+    int seps = 0;
+
+    if (len == 0 || (nodigit && IsDigit(str[0])))
+        return -1;
+
+    if (k->nonword && len >= k->block) {
+        for (;;) {
+            uint32_t mask = k->nonword(str + i, dash);
+            while (mask) {
+                if (Separator(str, len, i + Ctz(mask), sep, nodigit, &start))
+                    return -1;
+                mask &= mask - 1;
+                seps++;
+            }
+
+            i += k->block;
+            if (i == len) {
+                break;
+            } else if (i + k->block > len) {
+                // The tail is done by overlapping the last block with the
+                // previous one, ignoring the bytes we've already seen
+                size_t off = len - k->block;
+                uint32_t mask = k->nonword(str + off, dash) & (UINT32_MAX << (i - off));
+                while (mask) {
+                    if (Separator(str, len, off + Ctz(mask), sep, nodigit, &start))
+                        return -1;
+                    mask &= mask - 1;
+                    seps++;
+                }
+                i = len;
+                break;
+            }
+        }
+    }
+
+    for (; i < len; i++) {
+        if (!IsWord(str[i], dash)) {
+            if (Separator(str, len, i, sep, nodigit, &start))
+                return -1;
+            seps++;
+        }
+    }
+
+    return seps;
+}
+
+// ----------------------------------------------------------------------------
+
+adbus_Bool adbusI_isValidObjectPath(const char* str, size_t len)
+{
+    if (!str || len == 0 || str[0] != '/')
+        return 0;
+    if (len == 1)
+        return 1;
+
+    return CheckElements(str + 1, len - 1, '/', 0, 0) >= 0;
+}
+
+// ----------------------------------------------------------------------------
+
+// This is also used for error names
+adbus_Bool adbusI_isValidInterfaceName(const char* str, size_t len)
+{
+    if (!str || len > 255)
+        return 0;
+
+    // Interface names must include at least one '.'
+    return CheckElements(str, len, '.', 0, 1) >= 1;
+}
+
+// ----------------------------------------------------------------------------
+
+adbus_Bool adbusI_isValidBusName(const char* str, size_t len)
+{
+    if (!str || len > 255)
+        return 0;
+
+    // Elements of unique names may begin with a digit. Both forms must
+    // include at least one '.'
+    if (len > 0 && str[0] == ':') {
+        return CheckElements(str + 1, len - 1, '.', 1, 0) >= 1;
+    } else {
+        return CheckElements(str, len, '.', 1, 1) >= 1;
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+adbus_Bool adbusI_isValidMemberName(const char* str, size_t len)
+{
+    if (!str || len > 255)
+        return 0;
+
+    // A single element with no separators
+    return CheckElements(str, len, '\0', 0, 1) == 0;
+}
+
+// ----------------------------------------------------------------------------
+
+ADBUS_INLINE adbus_Bool IsContinuation(uint8_t c)
+{ return (c & 0xC0) == 0x80; }
+
+adbus_Bool adbusI_isValidUtf8(const char* str, size_t len)
+{
+    const struct Kernels* k = GetKernels();
+    const uint8_t* s = (const uint8_t*) str;
+    size_t i = 0;
+
+    if (!str)
+        return 1;
+
+    while (i < len) {
+        i += k->ascii(str + i, len - i);
+        if (i == len)
+            break;
+
+        uint8_t c = s[i];
+        if (c < 0x80) {
+            // 1 byte sequence (US-ASCII)
+            i += 1;
+
+        } else if (c < 0xC2) {
+            // Continuation byte without a start or an overlong 2 byte
+            // sequence
+            return 0;
+
+        } else if (c < 0xE0) {
+            // 2 byte sequence
+            if (len - i < 2 || !IsContinuation(s[i+1]))
+                return 0;
+            i += 2;
+
+        } else if (c < 0xF0) {
+            // 3 byte sequence
+            if (len - i < 3 || !IsContinuation(s[i+1]) || !IsContinuation(s[i+2]))
+                return 0;
+
+            // Overlong encoding
+            // 0x08 00 -> 0xE0 A0 80
+            if (c == 0xE0 && s[i+1] < 0xA0)
+                return 0;
+
+            // Code points [0xD800, 0xE000) are invalid (UTF16 surrogates)
+            // 0xD8 00 -> 0xED A0 80
+            if (c == 0xED && s[i+1] >= 0xA0)
+                return 0;
+
+            i += 3;
+
+        } else if (c < 0xF5) {
+            // 4 byte sequence
+            if (    len - i < 4
+                ||  !IsContinuation(s[i+1])
+                ||  !IsContinuation(s[i+2])
+                ||  !IsContinuation(s[i+3]))
+            {
+                return 0;
+            }
+
+            // Overlong encoding
+            // 0x01 00 00 -> 0xF0 90 80 80
+            if (c == 0xF0 && s[i+1] < 0x90)
+                return 0;
+
+            // Code points above 0x10FFFF
+            // 0x11 00 00 -> 0xF4 90 80 80
+            if (c == 0xF4 && s[i+1] >= 0x90)
+                return 0;
+
+            i += 4;
+
+        } else {
+            // 4 byte above 0x10FFFF, 5 byte, and 6 byte sequences
+            // restricted by RFC 3629
+            // 0xFE-0xFF invalid
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+// ----------------------------------------------------------------------------
+
+// The signature must be null terminated
+adbus_Bool adbusI_isValidSignature(const char* str, size_t len)
+{
+    if (!str || len > 255)
+        return 0;
+
+    const char* end = str + len;
+    while (str < end) {
+        str = adbus_nextarg(str);
+        if (str == NULL || str > end)
+            return 0;
+    }
+
+    return 1;
+}
+
@@ -26,78 +26,164 @@
 #define _GNU_SOURCE
 
 #include "dmem/list.h"
-#include <adbus/adbus.h>
+#include "dmem/queue.h"
+#include <adbus.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <netdb.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <errno.h>
 
+/* The server is split into a number of workers each running their own epoll
+ * loop on their own thread. Each remote is owned by a single worker which
+ * does all of the reading, auth, parsing and writing for that remote. The
+ * adbus_Server itself is shared between the workers and protected by a
+ * reader/writer lock (see adbus_serv_setlock), so that messages routed
+ * between remotes can be dispatched by all of the workers at once.
+ *
+ * When a message is dispatched to a remote owned by another worker, the
+ * message is shared (adbus_msg_share) and handed off via that worker's
+ * inbox, waking it up via its eventfd.
+ */
+
 struct Remote;
+struct Worker;
+
+struct Handoff
+{
+    struct Remote*      remote;
+    // NULL for a newly accepted remote that the worker should start polling
+    adbus_SharedMsg*    msg;
+};
+
 DLIST_INIT(Remote, struct Remote);
+DQUEUE_INIT(SharedMsg, adbus_SharedMsg*);
+DQUEUE_INIT(Handoff, struct Handoff);
 
-struct Server
+struct Worker
 {
-    int             efd;
-    int             fd;
-    adbus_Server*   bus;
-    d_List(Remote)  remotes;
-    d_List(Remote)  disconnect;
+    pthread_t           thread;
+    int                 efd;
+    int                 wakefd;
+    adbus_Server*       bus;
+    d_List(Remote)      remotes;
+    d_List(Remote)      disconnect;
+
+    // Handoffs from other threads protected by inboxLock
+    pthread_mutex_t     inboxLock;
+    d_Queue(Handoff)    inbox;
 };
 
 struct Remote
 {
     d_List(Remote)  hl;
+    struct Worker*  worker;
     adbus_Bool      disconnected;
-    adbus_Bool      sendblocked;
     int             fd;
     adbus_Auth*     auth;
     adbus_Remote*   remote;
-    adbus_Buffer*  rx;
-    adbus_Buffer*  tx;
+    adbus_Buffer*   rx;
+
+    // Messages waiting to be sent. These are refs to the same buffer that
+    // is queued on every other remote the message is sent to.
+    d_Queue(SharedMsg)  tx;
+    size_t              txoff;
 };
 
-void ServerRecv(struct Server* s)
+static __thread struct Worker* sCurrent;
+
+static void PushHandoff(struct Worker* w, struct Remote* r, adbus_SharedMsg* m)
 {
-    // Accept connections until it starts to fail (with EWOULDBLOCK)
+    pthread_mutex_lock(&w->inboxLock);
+    adbus_Bool wake = (dq_size(&w->inbox) == 0);
+    struct Handoff* h = dq_push_back(Handoff, &w->inbox, 1);
+    h->remote = r;
+    h->msg    = m;
+    pthread_mutex_unlock(&w->inboxLock);
+
+    if (wake) {
+        uint64_t one = 1;
+        write(w->wakefd, &one, sizeof(one));
+    }
+}
+
+static void DrainInbox(struct Worker* w)
+{
+    uint64_t count;
+    read(w->wakefd, &count, sizeof(count));
+
+    pthread_mutex_lock(&w->inboxLock);
+    while (dq_size(&w->inbox) > 0) {
+        struct Handoff h = dq_a(&w->inbox, 0);
+        dq_pop_front(Handoff, &w->inbox, 1);
+
+        struct Remote* r = h.remote;
+        if (h.msg) {
+            adbus_SharedMsg** pmsg = dq_push_back(SharedMsg, &r->tx, 1);
+            *pmsg = h.msg;
+        } else {
+            dl_insert_after(Remote, &w->remotes, r, &r->hl);
+
+            struct epoll_event reg = {0};
+            reg.events = EPOLLET | EPOLLIN | EPOLLOUT | EPOLLHUP | EPOLLRDHUP;
+            reg.data.ptr = r;
+            epoll_ctl(w->efd, EPOLL_CTL_ADD, r->fd, &reg);
+        }
+    }
+    pthread_mutex_unlock(&w->inboxLock);
+}
+
+static void ServerRecv(int sfd, struct Worker* workers, int num)
+{
+    static int next;
+
+    // Accept connections until it starts to fail (with EWOULDBLOCK) handing
+    // them out round robin
     while (1) {
-        int fd = accept4(s->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        int fd = accept4(sfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
         if (fd < 0)
             return;
 
         struct Remote* r = calloc(1, sizeof(struct Remote));
         r->fd = fd;
         r->rx = adbus_buf_new();
-        r->tx = adbus_buf_new();
-        dl_insert_after(Remote, &s->remotes, r, &r->hl);
-
-        struct epoll_event reg = {0};
-        reg.events = EPOLLET | EPOLLIN | EPOLLOUT | EPOLLHUP | EPOLLRDHUP;
-        reg.data.ptr = r;
-        epoll_ctl(s->efd, EPOLL_CTL_ADD, r->fd, &reg);
+        r->worker = &workers[next++ % num];
+        PushHandoff(r->worker, r, NULL);
     }
 }
 
-int Disconnect(struct Server* s, struct Remote* r)
+static int Disconnect(struct Worker* w, struct Remote* r)
 {
     assert(!r->disconnected);
     r->disconnected = 1;
     dl_remove(Remote, r, &r->hl);
-    dl_insert_after(Remote, &s->disconnect, r, &r->hl);
+    dl_insert_after(Remote, &w->disconnect, r, &r->hl);
     return 0;
 }
 
 static adbus_ssize_t Send(void* d, const char* b, size_t sz)
 { return send(((struct Remote*) d)->fd, b, sz, 0); }
 
+// Called with the server lock held from whichever worker is dispatching. As
+// the lock is shared this may be called by more than one worker at once, but
+// only the worker that owns the remote touches its tx queue directly.
 static adbus_ssize_t SendMsg(void* d, adbus_Message* m)
 {
     struct Remote* r = (struct Remote*) d;
-    adbus_buf_append(r->tx, m->data, m->size);
+    if (r->worker == sCurrent) {
+        adbus_SharedMsg** pmsg = dq_push_back(SharedMsg, &r->tx, 1);
+        *pmsg = adbus_msg_share(m);
+    } else {
+        PushHandoff(r->worker, r, adbus_msg_share(m));
+    }
     return m->size;
 }
 
@@ -105,7 +191,7 @@ static uint8_t Rand(void* d)
 { (void) d; return (uint8_t) rand(); }
 
 #define RECV_SIZE 64 * 1024
-void RemoteRecv(struct Server* s, struct Remote* r)
+static void RemoteRecv(struct Worker* w, struct Remote* r)
 {
     if (r->disconnected)
         return;
@@ -118,34 +204,34 @@ void RemoteRecv(struct Server* s, struct Remote* r)
         adbus_buf_recvd(b, RECV_SIZE, recvd);
     } while (recvd == RECV_SIZE);
 
-    if (recvd < 0 && recvd != EAGAIN) {
-        Disconnect(s, r);
+    if (recvd < 0 && errno != EAGAIN) {
+        Disconnect(w, r);
         return;
     }
 
     while (adbus_buf_size(b) > 0) {
         if (r->remote) {
             if (adbus_remote_parse(r->remote, b)) {
-                Disconnect(s, r);
+                Disconnect(w, r);
                 return;
             }
             break;
         } else if (r->auth) {
             int ret = adbus_auth_parse(r->auth, b);
             if (ret < 0) {
-                Disconnect(s, r);
+                Disconnect(w, r);
                 return;
             } else if (ret > 0) {
                 adbus_auth_free(r->auth);
                 r->auth = NULL;
-                r->remote = adbus_serv_connect(s->bus, &SendMsg, r);
+                r->remote = adbus_serv_connect(w->bus, &SendMsg, r);
             } else {
                 break;
             }
         } else {
             char* d = adbus_buf_data(b);
             if (*d != '\0') {
-                Disconnect(s, r);
+                Disconnect(w, r);
                 return;
             }
             adbus_buf_remove(b, 0, 1);
@@ -155,40 +241,147 @@ void RemoteRecv(struct Server* s, struct Remote* r)
     }
 }
 
-void RemoteSend(struct Server* s, struct Remote* r)
+#define IOV_NUM 64
+static void RemoteSend(struct Worker* w, struct Remote* r)
 {
-    const char* data = adbus_buf_data(r->tx);
-    size_t size = adbus_buf_size(r->tx);
-    if (!r->disconnected && r->remote && size > 0) {
-        adbus_ssize_t sent = send(r->fd, data, size, 0);
+    while (!r->disconnected && r->remote && dq_size(&r->tx) > 0) {
+        struct iovec iov[IOV_NUM];
+        size_t num = dq_size(&r->tx);
+        if (num > IOV_NUM)
+            num = IOV_NUM;
+
+        for (size_t i = 0; i < num; i++) {
+            adbus_SharedMsg* m = dq_a(&r->tx, i);
+            size_t off = (i == 0) ? r->txoff : 0;
+            iov[i].iov_base = (char*) m->data + off;
+            iov[i].iov_len  = m->size - off;
+        }
+
+        adbus_ssize_t sent = writev(r->fd, iov, (int) num);
         if (sent < 0) {
-            if (errno == EAGAIN) {
-                sent = 0;
-            } else {
-                Disconnect(s, r);
-                return;
+            if (errno != EAGAIN) {
+                Disconnect(w, r);
             }
+            return;
         }
 
-        adbus_buf_remove(r->tx, 0, sent);
+        // Release the messages that have been completely written
+        size_t left = (size_t) sent;
+        while (dq_size(&r->tx) > 0) {
+            adbus_SharedMsg* m = dq_a(&r->tx, 0);
+            size_t msgleft = m->size - r->txoff;
+            if (left < msgleft) {
+                r->txoff += left;
+                return;
+            }
+
+            left -= msgleft;
+            r->txoff = 0;
+            adbus_smsg_deref(m);
+            dq_pop_front(SharedMsg, &r->tx, 1);
+        }
     }
 }
 
-void DoDisconnect(struct Server* s)
+static void DoDisconnect(struct Worker* w)
 {
-    struct Remote* r;
-    DL_FOREACH(Remote, r, &s->disconnect, hl) {
-        epoll_ctl(s->efd, EPOLL_CTL_DEL, r->fd, NULL);
+    if (w->disconnect.next == NULL)
+        return;
+
+    // Once adbus_remote_disconnect returns no other worker can hand off a
+    // new message to the remote, so after draining the inbox below nothing
+    // else refers to the remote.
+    struct Remote* r = w->disconnect.next;
+    while (r) {
+        epoll_ctl(w->efd, EPOLL_CTL_DEL, r->fd, NULL);
         close(r->fd);
         adbus_auth_free(r->auth);
         adbus_remote_disconnect(r->remote);
-        adbus_buf_free(r->tx);
+        r->remote = NULL;
+        r = r->hl.next;
+    }
+
+    DrainInbox(w);
+
+    r = w->disconnect.next;
+    while (r) {
+        struct Remote* next = r->hl.next;
+        for (size_t i = 0; i < dq_size(&r->tx); i++) {
+            adbus_smsg_deref(dq_a(&r->tx, i));
+        }
+        dq_free(SharedMsg, &r->tx);
         adbus_buf_free(r->rx);
         free(r);
+        r = next;
+    }
+    dl_clear(Remote, &w->disconnect);
+}
+
+#define EVENT_NUM 4096
+static void* WorkerThread(void* u)
+{
+    struct Worker* w = (struct Worker*) u;
+    struct epoll_event* events = malloc(EVENT_NUM * sizeof(struct epoll_event));
+    sCurrent = w;
+
+    while (1) {
+        int ready = epoll_wait(w->efd, events, EVENT_NUM, -1);
+        if (ready < 0)
+            continue;
+
+        for (int i = 0; i < ready; i++) {
+            struct epoll_event* e = &events[i];
+            if (e->data.ptr == w) {
+                DrainInbox(w);
+            } else {
+                struct Remote* r = (struct Remote*) e->data.ptr;
+                if (r->disconnected)
+                    continue;
+                if (e->events & EPOLLERR) {
+                    Disconnect(w, r);
+                    continue;
+                }
+                if (e->events & EPOLLIN) {
+                    RemoteRecv(w, r);
+                }
+                if (r->disconnected)
+                    continue;
+                if ((e->events & EPOLLHUP) || (e->events & EPOLLRDHUP)) {
+                    Disconnect(w, r);
+                    continue;
+                }
+                if (e->events & EPOLLOUT) {
+                    RemoteSend(w, r);
+                }
+            }
+        }
+
+        // Messages may have been queued on remotes that had no events this
+        // time around
+        DrainInbox(w);
+        struct Remote* r = w->remotes.next;
+        while (r) {
+            struct Remote* next = r->hl.next;
+            RemoteSend(w, r);
+            r = next;
+        }
+
+        DoDisconnect(w);
     }
-    dl_clear(Remote, &s->disconnect);
+
+    free(events);
+    return NULL;
 }
 
+static void Lock(void* u)
+{ pthread_rwlock_wrlock((pthread_rwlock_t*) u); }
+
+static void LockShared(void* u)
+{ pthread_rwlock_rdlock((pthread_rwlock_t*) u); }
+
+static void Unlock(void* u)
+{ pthread_rwlock_unlock((pthread_rwlock_t*) u); }
+
 static void error()
 {
     fprintf(stderr, "%s\n", strerror(errno));
@@ -261,6 +454,9 @@ static adbus_Socket Tcp(const char* port)
         if (sfd == ADBUS_SOCK_INVALID)
             continue;
 
+        int reuse = 1;
+        setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
         if (bind(sfd, rp->ai_addr, rp->ai_addrlen) != -1)
             break;                  /* Success */
 
@@ -273,60 +469,60 @@ static adbus_Socket Tcp(const char* port)
     return sfd;
 }
 
-#define EVENT_NUM 4096
-int main()
+int main(int argc, char* argv[])
 {
-    struct Server server = {0};
-    server.bus = adbus_serv_new();
-    //server.fd = Abstract("/tmp/dbus-socket");
-    server.fd = Tcp("12345");
-    server.efd = epoll_create1(EPOLL_CLOEXEC);
-    if (server.fd == ADBUS_SOCK_INVALID || server.efd == ADBUS_SOCK_INVALID)
+    int num = (argc > 1) ? atoi(argv[1]) : (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (num < 1)
+        num = 1;
+
+    static pthread_rwlock_t buslock = PTHREAD_RWLOCK_INITIALIZER;
+    adbus_Server* bus = adbus_serv_new(adbus_iface_new("org.freedesktop.DBus", -1));
+    adbus_serv_setlock(bus, &Lock, &Unlock, &LockShared, &Unlock, &buslock);
+
+    //int sfd = Abstract("/tmp/dbus-socket");
+    int sfd = Tcp("12345");
+    int efd = epoll_create1(EPOLL_CLOEXEC);
+    if (sfd == ADBUS_SOCK_INVALID || efd < 0)
         error();
 
+    struct Worker* workers = calloc(num, sizeof(struct Worker));
+    for (int i = 0; i < num; i++) {
+        struct Worker* w = &workers[i];
+        w->bus = bus;
+        w->efd = epoll_create1(EPOLL_CLOEXEC);
+        w->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (w->efd < 0 || w->wakefd < 0)
+            error();
+
+        pthread_mutex_init(&w->inboxLock, NULL);
+
+        struct epoll_event wake_event = {0};
+        wake_event.events = EPOLLIN | EPOLLET;
+        wake_event.data.ptr = w;
+        if (epoll_ctl(w->efd, EPOLL_CTL_ADD, w->wakefd, &wake_event))
+            error();
+
+        if (pthread_create(&w->thread, NULL, &WorkerThread, w))
+            error();
+    }
+
     struct epoll_event serv_event = {0};
     serv_event.events = EPOLLIN | EPOLLET;
-    serv_event.data.ptr = &server;
-    if (epoll_ctl(server.efd, EPOLL_CTL_ADD, server.fd, &serv_event))
+    if (epoll_ctl(efd, EPOLL_CTL_ADD, sfd, &serv_event))
         error();
 
-    if (listen(server.fd, SOMAXCONN))
+    if (listen(sfd, SOMAXCONN))
         error();
 
-    struct epoll_event events[EVENT_NUM];
+    // The main thread just accepts new connections and hands them off to the
+    // workers
     while (1) {
-        int ready = epoll_wait(server.efd, events, EVENT_NUM, -1);
-        if (ready < 0)
-            continue;
-
-        for (int i = 0; i < ready; i++) {
-            struct epoll_event* e = &events[i];
-            if (e->data.ptr == &server) {
-                if (e->events & EPOLLIN) {
-                    ServerRecv(&server);
-                }
-            } else {
-                struct Remote* r = (struct Remote*) e->data.ptr;
-                if (e->events & EPOLLERR) {
-                    Disconnect(&server, r);
-                    continue;
-                }
-                if (e->events & EPOLLIN) {
-                    RemoteRecv(&server, r);
-                }
-                if ((e->events & EPOLLHUP) || (e->events & EPOLLRDHUP)) {
-                    Disconnect(&server, r);
-                    continue;
-                }
-                if (e->events & EPOLLOUT) {
-                    RemoteSend(&server, r);
-                }
-            }
+        struct epoll_event e;
+        int ready = epoll_wait(efd, &e, 1, -1);
+        if (ready > 0 && (e.events & EPOLLIN)) {
+            ServerRecv(sfd, workers, num);
         }
-
-        DoDisconnect(&server);
     }
 
     return 0;
 }
-
@@ -0,0 +1,121 @@
+/* vim: ts=4 sw=4 sts=4 et
+ *
+ * Copyright (c) 2009 James R. McKaskill
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * ----------------------------------------------------------------------------
+ */
+
+/* Microbenchmark of the client side cost of a method call through a proxy
+ * (setting up the call, building the message and registering the reply)
+ * without the round trip to the ping server.
+ */
+
+#include <adbus.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#   include <windows.h>
+#else
+#   include <sys/time.h>
+#endif
+
+static uint64_t Now()
+{
+#ifdef _WIN32
+    LARGE_INTEGER now, freq;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (uint64_t) (now.QuadPart * 1000000000 / freq.QuadPart);
+#else
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_usec * 1000;
+#endif
+}
+
+static size_t sent = 0;
+
+static adbus_ssize_t Send(void* d, adbus_Message* m)
+{
+    (void) d;
+    sent += m->size;
+    return m->size;
+}
+
+static int Reply(adbus_CbData* d)
+{
+    (void) d;
+    return 0;
+}
+
+#define REPEAT 1000000
+
+int main()
+{
+    adbus_ConnectionCallbacks cbs = {0};
+    cbs.send_message = &Send;
+
+    adbus_Connection* c = adbus_conn_new(&cbs, NULL);
+    adbus_State* s = adbus_state_new();
+    adbus_Proxy* p = adbus_proxy_new(s);
+    adbus_proxy_init(p, c, "nz.co.foobar.adbus.PingServer", -1, "/", -1);
+
+    // No reply
+    uint64_t start = Now();
+    for (int i = 0; i < REPEAT; ++i) {
+        adbus_Call f;
+        adbus_call_method(p, &f, "Ping", -1);
+
+        adbus_msg_setsig(f.msg, "s", -1);
+        adbus_msg_string(f.msg, "str", -1);
+
+        adbus_call_send(p, &f);
+    }
+    uint64_t noreply = (Now() - start) / REPEAT;
+
+    // With a reply registered, as in client.c
+    start = Now();
+    for (int i = 0; i < REPEAT; ++i) {
+        adbus_Call f;
+        adbus_call_method(p, &f, "Ping", -1);
+        f.callback = &Reply;
+
+        adbus_msg_setsig(f.msg, "s", -1);
+        adbus_msg_string(f.msg, "str", -1);
+
+        adbus_call_send(p, &f);
+
+        // Clear out the reply again
+        adbus_state_reset(s);
+    }
+    uint64_t reply = (Now() - start) / REPEAT;
+
+    fprintf(stderr, "No reply %d ns, reply %d ns (%d bytes sent)\n",
+            (int) noreply, (int) reply, (int) sent);
+
+    adbus_proxy_free(p);
+    adbus_state_free(s);
+    adbus_conn_free(c);
+
+    return 0;
+}
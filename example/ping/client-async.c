@@ -32,6 +32,7 @@
 #else
 #   include <sys/socket.h>
 #   include <sys/time.h>
+#   include <sys/uio.h>
 #endif
 
 
@@ -40,9 +41,44 @@ static int replies = 0;
 static adbus_ssize_t Send(void* d, adbus_Message* m)
 { return send(*(adbus_Socket*) d, m->data, m->size, 0); }
 
+// Writes out a batch of queued messages with a single syscall
+#define IOV_NUM 64
+static adbus_ssize_t SendMsgs(void* d, adbus_SharedMsg** msgs, size_t num)
+{
+    adbus_Socket sock = *(adbus_Socket*) d;
+    adbus_ssize_t sent = 0;
+    while (num > 0) {
+        size_t tosend = num < IOV_NUM ? num : IOV_NUM;
+#ifdef _WIN32
+        WSABUF bufs[IOV_NUM];
+        DWORD ret;
+        for (size_t i = 0; i < tosend; i++) {
+            bufs[i].buf = (char*) msgs[i]->data;
+            bufs[i].len = (ULONG) msgs[i]->size;
+        }
+        if (WSASend(sock, bufs, (DWORD) tosend, &ret, 0, NULL, NULL))
+            return -1;
+#else
+        struct iovec iov[IOV_NUM];
+        adbus_ssize_t ret;
+        for (size_t i = 0; i < tosend; i++) {
+            iov[i].iov_base = (void*) msgs[i]->data;
+            iov[i].iov_len  = msgs[i]->size;
+        }
+        ret = writev(sock, iov, (int) tosend);
+        if (ret < 0)
+            return -1;
+#endif
+        sent += ret;
+        msgs += tosend;
+        num  -= tosend;
+    }
+    return sent;
+}
+
 static int Reply(adbus_CbData* d)
 {
-    const char* rep = adbus_check_string(d, NULL);
+    adbus_check_string(d, NULL);
     adbus_check_end(d);
 
     replies--;
@@ -51,6 +87,7 @@ static int Reply(adbus_CbData* d)
 
 #define RECV_SIZE 64 * 1024
 #define REPEAT 1000000
+#define QUEUE_SIZE 64 * 1024
 int main()
 {
 
@@ -73,11 +110,18 @@ int main()
     if (sock == ADBUS_SOCK_INVALID || adbus_sock_cauth(sock, buf))
         abort();
 
-    adbus_Connection* c = adbus_conn_new();
-    adbus_conn_setsender(c, &Send, &sock);
+    adbus_ConnectionCallbacks cbs = {0};
+    cbs.send_message  = &Send;
+    cbs.send_messages = &SendMsgs;
+
+    adbus_Connection* c = adbus_conn_new(&cbs, &sock);
 
     adbus_conn_connect(c, NULL, NULL);
 
+    // Batch up the calls so that they go out QUEUE_SIZE bytes at a time
+    // rather than a send per call
+    adbus_conn_setqueue(c, QUEUE_SIZE);
+
     adbus_State* s = adbus_state_new();
     adbus_Proxy* p = adbus_proxy_new(s);
     adbus_proxy_init(p, c, "nz.co.foobar.adbus.PingServer", -1, "/", -1);
@@ -95,6 +139,9 @@ int main()
         adbus_call_send(p, &f);
     }
 
+    if (adbus_conn_flush(c))
+        abort();
+
     while(replies > 0) {
         char* dest = adbus_buf_recvbuf(buf, RECV_SIZE);
         adbus_ssize_t recvd = recv(sock, dest, RECV_SIZE, 0);
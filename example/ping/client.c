@@ -36,19 +36,13 @@
 #endif
 
 
-static int replies = 0;
-
 static adbus_ssize_t Send(void* d, adbus_Message* m)
 { return send(*(adbus_Socket*) d, m->data, m->size, 0); }
 
-#define RECV_SIZE 64 * 1024
-
 static int Reply(adbus_CbData* d)
 {
-    const char* rep = adbus_check_string(d, NULL);
+    adbus_check_string(d, NULL);
     adbus_check_end(d);
-
-    replies--;
     return 0;
 }
 
@@ -76,18 +70,21 @@ int main()
     if (sock == ADBUS_SOCK_INVALID || adbus_sock_cauth(sock, buf))
         return 1;
 
-    adbus_Connection* c = adbus_conn_new();
-    adbus_conn_setsender(c, &Send, &sock);
+    adbus_ConnectionCallbacks cbs = {0};
+    cbs.send_message = &Send;
+
+    adbus_Connection* c = adbus_conn_new(&cbs, &sock);
+    adbus_conn_setsocket(c, sock, buf);
 
     adbus_conn_connect(c, NULL, NULL);
+    if (adbus_conn_block(c, ADBUS_WAIT_FOR_CONNECTED, -1))
+        return 1;
 
     adbus_State* s = adbus_state_new();
     adbus_Proxy* p = adbus_proxy_new(s);
     adbus_proxy_init(p, c, "nz.co.foobar.adbus.PingServer", -1, "/", -1);
 
     for (int i = 0; i < REPEAT; ++i) {
-        replies++;
-
         adbus_Call f;
         adbus_call_method(p, &f, "Ping", -1);
         f.callback = &Reply;
@@ -95,18 +92,8 @@ int main()
         adbus_msg_setsig(f.msg, "s", -1);
         adbus_msg_string(f.msg, "str", -1);
 
-        adbus_call_send(p, &f);
-
-        while(replies > 0) {
-            char* dest = adbus_buf_recvbuf(buf, RECV_SIZE);
-            adbus_ssize_t recvd = recv(sock, dest, RECV_SIZE, 0);
-            adbus_buf_recvd(buf, RECV_SIZE, recvd);
-            if (recvd < 0)
-                abort();
-
-            if (adbus_conn_parse(c, buf))
-                abort();
-        }
+        if (adbus_call_block(p, &f, -1))
+            abort();
     }
 
     adbus_proxy_free(p);
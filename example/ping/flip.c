@@ -0,0 +1,125 @@
+/* vim: ts=4 sw=4 sts=4 et
+ *
+ * Copyright (c) 2009 James R. McKaskill
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * ----------------------------------------------------------------------------
+ */
+
+/* Microbenchmark of adbus_flip_data on large arrays of fixed size values
+ * (eg sensor data sent from a big endian machine).
+ */
+
+#include <adbus.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#   include <windows.h>
+#else
+#   include <sys/time.h>
+#endif
+
+static uint64_t Now()
+{
+#ifdef _WIN32
+    LARGE_INTEGER now, freq;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (uint64_t) (now.QuadPart * 1000000000 / freq.QuadPart);
+#else
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_usec * 1000;
+#endif
+}
+
+static void Flip(char* p, int width)
+{
+    for (int i = 0; i < width / 2; i++) {
+        char t = p[i];
+        p[i] = p[width - 1 - i];
+        p[width - 1 - i] = t;
+    }
+}
+
+// Flips the array length back to non-native. The values themselves are left
+// as is as flipping them again just flips them back.
+static void ResetLength(char* data)
+{ Flip(data, 4); }
+
+#define TOTAL (256 * 1024 * 1024)
+
+static void Run(const char* sig, int width, size_t bytes)
+{
+    adbus_Buffer* b = adbus_buf_new();
+    adbus_buf_setsig(b, sig, -1);
+
+    adbus_BufArray a;
+    adbus_buf_beginarray(b, &a);
+    for (size_t i = 0; i < bytes / width; i++) {
+        adbus_buf_arrayentry(b, &a);
+        switch (width) {
+            case 2:
+                adbus_buf_u16(b, (uint16_t) i);
+                break;
+            case 4:
+                adbus_buf_u32(b, (uint32_t) i);
+                break;
+            case 8:
+                adbus_buf_double(b, (double) i);
+                break;
+        }
+    }
+    adbus_buf_endarray(b, &a);
+
+    char* data  = (char*) adbus_buf_data(b);
+    size_t size = adbus_buf_size(b);
+    ResetLength(data);
+
+    int repeat = (int) (TOTAL / bytes);
+    uint64_t total = 0;
+    for (int i = 0; i < repeat; i++) {
+        uint64_t start = Now();
+        if (adbus_flip_data(data, size, sig))
+            abort();
+        total += Now() - start;
+        ResetLength(data);
+    }
+
+    double secs = (double) total / 1e9;
+    fprintf(stderr, "%s %8d KiB %8.0f MB/s\n",
+            sig, (int) (bytes / 1024), (double) bytes * repeat / secs / 1e6);
+
+    adbus_buf_free(b);
+}
+
+int main()
+{
+    static const size_t sizes[] = {64 * 1024, 1024 * 1024, 16 * 1024 * 1024};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        Run("aq", 2, sizes[i]);
+        Run("au", 4, sizes[i]);
+        Run("ad", 8, sizes[i]);
+    }
+    return 0;
+}
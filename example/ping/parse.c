@@ -0,0 +1,136 @@
+/* vim: ts=4 sw=4 sts=4 et
+ *
+ * Copyright (c) 2009 James R. McKaskill
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * ----------------------------------------------------------------------------
+ */
+
+/* Microbenchmark of adbus_parse on the header of a typical method call (the
+ * ping call as sent through the bus) in native and non-native byte order.
+ */
+
+#include <adbus.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#   include <windows.h>
+#else
+#   include <sys/time.h>
+#endif
+
+#define REPEAT 1000000
+
+static uint64_t Now()
+{
+#ifdef _WIN32
+    LARGE_INTEGER now, freq;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (uint64_t) (now.QuadPart * 1000000000 / freq.QuadPart);
+#else
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_usec * 1000;
+#endif
+}
+
+static void Flip32(char* p)
+{
+    char t = p[0]; p[0] = p[3]; p[3] = t;
+    t = p[1]; p[1] = p[2]; p[2] = t;
+}
+
+// Converts a native message with only string and object path header fields
+// and no arguments to the opposite byte order
+static void ToNonNative(char* data, adbus_Message* m)
+{
+    data[0] = (data[0] == 'l') ? 'B' : 'l';
+    Flip32(data + 4);
+    Flip32(data + 8);
+    Flip32(data + 12);
+
+    const char* strs[] = {m->path, m->interface, m->member, m->destination, m->sender};
+    for (size_t i = 0; i < sizeof(strs) / sizeof(strs[0]); i++) {
+        if (strs[i]) {
+            Flip32(data + (strs[i] - m->data) - 4);
+        }
+    }
+}
+
+#define COPIES 10000
+
+// Parsing a non-native message flips it in place so we parse fresh copies,
+// recreating them outside of the timed loop
+static void Run(const char* name, const char* msg, size_t size, adbus_Bool native)
+{
+    size_t stride = ADBUS_ALIGN(size, 8);
+    char* data = (char*) malloc(stride * COPIES + 8);
+    char* aligned = (char*) ADBUS_ALIGN(data, 8);
+
+    adbus_Message m;
+    uint64_t total = 0;
+    for (int i = 0; i < REPEAT / COPIES; i++) {
+        for (int j = 0; j < COPIES; j++) {
+            char* copy = aligned + j * stride;
+            memcpy(copy, msg, size);
+            if (!native) {
+                adbus_Message n;
+                adbus_parse(&n, copy, size);
+                ToNonNative(copy, &n);
+            }
+        }
+
+        uint64_t start = Now();
+        for (int j = 0; j < COPIES; j++) {
+            if (adbus_parse(&m, aligned + j * stride, size))
+                abort();
+        }
+        total += Now() - start;
+    }
+
+    fprintf(stderr, "%s %d ns\n", name, (int) (total / REPEAT));
+    free(data);
+}
+
+int main()
+{
+    adbus_MsgFactory* f = adbus_msg_new();
+    adbus_msg_settype(f, ADBUS_MSG_METHOD);
+    adbus_msg_setserial(f, 1);
+    adbus_msg_setpath(f, "/", -1);
+    adbus_msg_setinterface(f, "nz.co.foobar.adbus.PingServer", -1);
+    adbus_msg_setmember(f, "Ping", -1);
+    adbus_msg_setdestination(f, "nz.co.foobar.adbus.PingServer", -1);
+    adbus_msg_setsender(f, ":1.23", -1);
+
+    adbus_Message m;
+    if (adbus_msg_build(f, &m))
+        abort();
+
+    Run("Native", m.data, m.size, 1);
+    Run("Non-native", m.data, m.size, 0);
+
+    adbus_msg_free(f);
+    return 0;
+}
@@ -0,0 +1,165 @@
+/* vim: ts=4 sw=4 sts=4 et
+ *
+ * Copyright (c) 2009 James R. McKaskill
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * ----------------------------------------------------------------------------
+ */
+
+/* Benchmark of the object path registry with a large number of paths. Binds
+ * an interface to N x M paths of the form /com/example/devN/objM, then
+ * reports the time and memory used to bind them, the time to look them all
+ * up through adbus_conn_interface and the time to unbind them. Finally it
+ * times unbinding a large number of siblings under a single parent.
+ *
+ * Usage: paths [devices] [objects per device]
+ */
+
+#include <adbus.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#   include <windows.h>
+#   include <psapi.h>
+#   pragma comment(lib, "psapi.lib")
+#else
+#   include <sys/time.h>
+#   include <unistd.h>
+#endif
+
+static uint64_t Now()
+{
+#ifdef _WIN32
+    LARGE_INTEGER now, freq;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (uint64_t) (now.QuadPart * 1000000000 / freq.QuadPart);
+#else
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_usec * 1000;
+#endif
+}
+
+// Resident memory in KiB
+static long Memory()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+        return 0;
+    return (long) (pmc.WorkingSetSize / 1024);
+#else
+    long size, resident;
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (!f)
+        return 0;
+    if (fscanf(f, "%ld %ld", &size, &resident) != 2)
+        resident = 0;
+    fclose(f);
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+#endif
+}
+
+static double Ms(uint64_t start)
+{ return (double) (Now() - start) / 1e6; }
+
+static adbus_ssize_t Send(void* d, adbus_Message* m)
+{ (void) d; return m->size; }
+
+// Visits the paths in a scrambled order so that lookups and unbinds don't
+// just walk the paths in the order they were bound
+static int Scramble(int i, int num)
+{ return (int) ((int64_t) i * 7919 % num); }
+
+static void Bind(adbus_Connection* c, adbus_Interface* i, const char* path, adbus_ConnBind** bind)
+{
+    adbus_Bind b;
+    adbus_bind_init(&b);
+    b.path      = path;
+    b.interface = i;
+    *bind = adbus_conn_bind(c, &b);
+    if (!*bind)
+        abort();
+}
+
+int main(int argc, char* argv[])
+{
+    int devices = argc > 1 ? atoi(argv[1]) : 1000;
+    int objects = argc > 2 ? atoi(argv[2]) : 1000;
+    int num     = devices * objects;
+
+    adbus_ConnectionCallbacks cbs;
+    memset(&cbs, 0, sizeof(cbs));
+    cbs.send_message = &Send;
+
+    adbus_Connection* c = adbus_conn_new(&cbs, NULL);
+    adbus_Interface* i = adbus_iface_new("com.example.Device", -1);
+    adbus_iface_addmethod(i, "Ping", -1);
+
+    adbus_ConnBind** binds = (adbus_ConnBind**) malloc(num * sizeof(adbus_ConnBind*));
+    char path[64];
+
+    long mem = Memory();
+    uint64_t start = Now();
+    for (int d = 0; d < devices; d++) {
+        for (int o = 0; o < objects; o++) {
+            sprintf(path, "/com/example/dev%d/obj%d", d, o);
+            Bind(c, i, path, &binds[d * objects + o]);
+        }
+    }
+    fprintf(stderr, "bind   %8d paths %8.0f ms %8ld KiB\n", num, Ms(start), Memory() - mem);
+
+    start = Now();
+    for (int j = 0; j < num; j++) {
+        int k = Scramble(j, num);
+        sprintf(path, "/com/example/dev%d/obj%d", k / objects, k % objects);
+        if (!adbus_conn_interface(c, path, -1, "com.example.Device", -1, NULL))
+            abort();
+    }
+    fprintf(stderr, "lookup %8d paths %8.0f ms\n", num, Ms(start));
+
+    start = Now();
+    for (int j = 0; j < num; j++) {
+        adbus_conn_unbind(c, binds[Scramble(j, num)]);
+    }
+    fprintf(stderr, "unbind %8d paths %8.0f ms\n", num, Ms(start));
+
+    // Siblings are all children of the one node
+    int siblings = num / 10;
+    for (int j = 0; j < siblings; j++) {
+        sprintf(path, "/com/example/flat/obj%d", j);
+        Bind(c, i, path, &binds[j]);
+    }
+
+    start = Now();
+    for (int j = 0; j < siblings; j++) {
+        adbus_conn_unbind(c, binds[j]);
+    }
+    fprintf(stderr, "unbind %8d siblings %5.0f ms\n", siblings, Ms(start));
+
+    free(binds);
+    adbus_iface_deref(i);
+    adbus_conn_free(c);
+    return 0;
+}
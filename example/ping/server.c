@@ -213,8 +213,10 @@ int main()
     if (sock == ADBUS_SOCK_INVALID || adbus_sock_cauth(sock, buf))
         abort();
 
-    adbus_Connection* c = adbus_conn_new();
-    adbus_conn_setsender(c, &Send, &sock);
+    adbus_ConnectionCallbacks cbs = {0};
+    cbs.send_message = &Send;
+
+    adbus_Connection* c = adbus_conn_new(&cbs, &sock);
 
     adbus_Interface* i = adbus_iface_new("nz.co.foobar.adbus.PingTest", -1);
 
@@ -321,6 +321,34 @@ ADBUS_INLINE int adbus_iter_alignfield(adbus_Iterator* i, char field)
     }
 }
 
+// Returns the size of a fixed size type whose arrays can be handled as one
+// block or 0 for all other types
+ADBUS_INLINE int adbusI_iter_fixedwidth(char field)
+{
+    switch (field)
+    {
+        case 'y': // u8
+            return 1;
+
+        case 'n': // i16
+        case 'q': // u16
+            return 2;
+
+        case 'b': // bool
+        case 'i': // i32
+        case 'u': // u32
+            return 4;
+
+        case 'x': // i64
+        case 't': // u64
+        case 'd': // double
+            return 8;
+
+        default:
+            return 0;
+    }
+}
+
 ADBUS_INLINE int adbusI_iter_sig(adbus_Iterator* i, char field)
 {
     if (*i->sig++ != field) {
@@ -509,7 +537,7 @@ ADBUS_INLINE int adbus_iter_beginarray(adbus_Iterator* i, adbus_IterArray* a)
     if (*len > ADBUS_MAXIMUM_ARRAY_LENGTH)
         return -1;
 
-    if (adbus_iter_alignfield(i, *i->sig))
+    if (adbus_iter_alignfield(i, *i->sig) || *len > i->size)
         return -1;
 
     const char* sigend = adbus_nextarg(i->sig);
@@ -541,11 +569,53 @@ ADBUS_INLINE adbus_Bool adbus_iter_inarray(adbus_Iterator* i, adbus_IterArray* a
  */
 ADBUS_INLINE int adbus_iter_endarray(adbus_Iterator* i, adbus_IterArray* a)
 {
+    i->size -= (a->data + a->size) - i->data;
     i->data = a->data + a->size;
     i->sig = a->sig + a->sigsz;
     return 0;
 }
 
+/** Pulls out a whole array of fixed size values (dbus sig "ay", "au", "ad",
+ *  etc).
+ *  \relates adbus_Iterator
+ *
+ *  \param[in]  i       The iterator
+ *  \param[out] data    Beginning of the array data, aligned for the element
+ *                      type
+ *  \param[out] size    Size of the array data in bytes
+ *
+ *  This is equivalent to iterating over the array entry by entry but gives
+ *  the array data as a single block. The element type must be one of y, n,
+ *  q, b, i, u, x, t, or d. The data is in native endianness (messages of
+ *  the other endianness have already been flipped by adbus_flip_data()).
+ *
+ *  For example to pull out an "ay" blob:
+ *
+ *  \code
+ *  const uint8_t* blob;
+ *  size_t size;
+ *  if (adbus_iter_fixedarray(iter, (const char**) &blob, &size))
+ *      return -1;
+ *  \endcode
+ */
+ADBUS_INLINE int adbus_iter_fixedarray(adbus_Iterator* i, const char** data, size_t* size)
+{
+    adbus_IterArray a;
+    if (adbus_iter_beginarray(i, &a))
+        return -1;
+
+    int width = (a.sigsz == 1) ? adbusI_iter_fixedwidth(*a.sig) : 0;
+    if (width == 0 || a.size % width != 0)
+        return -1;
+
+    if (data)
+        *data = a.data;
+    if (size)
+        *size = a.size;
+
+    return adbus_iter_endarray(i, &a);
+}
+
 /** Begins a dict entry scope (dbus sig "{").
  *  \relates adbus_Iterator
  */
@@ -163,6 +163,7 @@ typedef struct adbus_Proxy              adbus_Proxy;
 typedef struct adbus_Reply              adbus_Reply;
 typedef struct adbus_Remote             adbus_Remote;
 typedef struct adbus_Server             adbus_Server;
+typedef struct adbus_SharedMsg          adbus_SharedMsg;
 typedef struct adbus_Signal             adbus_Signal;
 typedef struct adbus_State              adbus_State;
 typedef enum adbus_BlockType            adbus_BlockType;
@@ -263,6 +264,18 @@ struct adbus_Message
 
     adbus_Argument*         arguments;
     size_t                  argumentsSize;
+
+    adbus_SharedMsg*        shared;
+};
+
+struct adbus_SharedMsg
+{
+    const char*             data;
+    size_t                  size;
+
+    /** \privatesection */
+    long volatile           ref;
+    char*                   alloc;
 };
 
 ADBUS_API int adbus_parse(adbus_Message* m, char* data, size_t size);
@@ -271,6 +284,9 @@ ADBUS_API void adbus_freeargs(adbus_Message* m);
 ADBUS_API size_t adbus_parse_size(const char* data, size_t size);
 ADBUS_API void adbus_clonedata(adbus_Message* from, adbus_Message* to);
 ADBUS_API void adbus_freedata(adbus_Message* m);
+ADBUS_API adbus_SharedMsg* adbus_msg_share(adbus_Message* m);
+ADBUS_API void adbus_smsg_ref(adbus_SharedMsg* s);
+ADBUS_API void adbus_smsg_deref(adbus_SharedMsg* s);
 
 
 ADBUS_API int adbus_connect_address(
@@ -360,9 +376,11 @@ ADBUS_API int adbus_error_argument(
 
 
 typedef adbus_ssize_t   (*adbus_SendMsgCallback)(void*, adbus_Message*);
+typedef adbus_ssize_t   (*adbus_SendMsgsCallback)(void*, adbus_SharedMsg**, size_t);
 typedef void            (*adbus_GetProxyCallback)(void*, adbus_ProxyCallback*, adbus_ProxyMsgCallback*, void**);
 typedef adbus_Bool      (*adbus_ShouldProxyCallback)(void*);
 typedef int             (*adbus_BlockCallback)(void*, adbus_BlockType, int timeoutms);
+typedef void            (*adbus_ChildrenCallback)(void*, const char*, size_t, adbus_Buffer*);
 
 struct adbus_ConnectionCallbacks
 {
@@ -372,6 +390,7 @@ struct adbus_ConnectionCallbacks
     adbus_ShouldProxyCallback     should_proxy;
     adbus_GetProxyCallback        get_proxy;
     adbus_BlockCallback           block;
+    adbus_SendMsgsCallback        send_messages;
 };
 
 ADBUS_API adbus_Connection* adbus_conn_new(adbus_ConnectionCallbacks* cb, void* user);
@@ -393,6 +412,26 @@ ADBUS_API int adbus_conn_send(
         adbus_Connection*       connection,
         adbus_Message*          message);
 
+ADBUS_API void adbus_conn_setqueue(
+        adbus_Connection*       connection,
+        size_t                  threshold);
+
+ADBUS_API int adbus_conn_flush(
+        adbus_Connection*       connection);
+
+ADBUS_API void adbus_conn_setthreaded(
+        adbus_Connection*       connection,
+        adbus_Bool              enable);
+
+ADBUS_API void adbus_conn_setarena(
+        adbus_Connection*       connection,
+        adbus_Bool              enable);
+
+ADBUS_API void adbus_conn_arenastats(
+        adbus_Connection*       connection,
+        size_t*                 messages,
+        size_t*                 mallocs);
+
 ADBUS_API adbus_Bool adbus_conn_shouldproxy(
         adbus_Connection*   connection);
 
@@ -407,6 +446,11 @@ ADBUS_API void adbus_conn_getproxy(
         adbus_ProxyMsgCallback* msgcb,
         void**                  user);
 
+ADBUS_API void adbus_conn_setsocket(
+        adbus_Connection*       connection,
+        adbus_Socket            sock,
+        adbus_Buffer*           buffer);
+
 ADBUS_API int adbus_conn_block(
         adbus_Connection*       connection,
         adbus_BlockType         type,
@@ -500,6 +544,8 @@ struct adbus_Reply
 
     adbus_ProxyCallback     relproxy;
     void*                   relpuser;
+
+    int                     timeout;
 };
 
 ADBUS_API void adbus_reply_init(adbus_Reply* reply);
@@ -520,6 +566,9 @@ struct adbus_Bind
 
     adbus_ProxyCallback     relproxy;
     void*                   relpuser;
+
+    adbus_Bool              fallback;
+    adbus_ChildrenCallback  children;
 };
 
 ADBUS_API void adbus_bind_init(adbus_Bind* bind);
@@ -533,6 +582,11 @@ ADBUS_API void adbus_conn_removematch(
         adbus_Connection*       connection,
         adbus_ConnMatch*        match);
 
+ADBUS_API void adbus_conn_matchstats(
+        adbus_Connection*       connection,
+        size_t*                 messages,
+        size_t*                 examined);
+
 ADBUS_API adbus_ConnReply* adbus_conn_addreply(
         adbus_Connection*       connection,
         const adbus_Reply*      reply);
@@ -541,6 +595,9 @@ ADBUS_API void adbus_conn_removereply(
         adbus_Connection*       connection,
         adbus_ConnReply*        reply);
 
+ADBUS_API int adbus_conn_timeout(
+        adbus_Connection*       connection);
+
 ADBUS_API adbus_ConnBind* adbus_conn_bind(
         adbus_Connection*   connection,
         const adbus_Bind*   bind);
@@ -580,6 +637,7 @@ ADBUS_API adbus_Interface* adbus_iface_new(const char* name, int size);
 ADBUS_API void adbus_iface_ref(adbus_Interface* interface);
 ADBUS_API void adbus_iface_deref(adbus_Interface* interface);
 #define adbus_iface_free(iface) adbus_iface_deref(iface)
+ADBUS_API void adbus_iface_freeze(adbus_Interface* interface);
 
 ADBUS_API adbus_Member* adbus_iface_addmethod(
         adbus_Interface*    interface,
@@ -693,6 +751,7 @@ ADBUS_INLINE int adbus_iter_signature(adbus_Iterator* i, const char** pstr, size
 ADBUS_INLINE int adbus_iter_beginarray(adbus_Iterator* i, adbus_IterArray* a);
 ADBUS_INLINE adbus_Bool adbus_iter_inarray(adbus_Iterator* i, adbus_IterArray* a);
 ADBUS_INLINE int adbus_iter_endarray(adbus_Iterator* i, adbus_IterArray* a);
+ADBUS_INLINE int adbus_iter_fixedarray(adbus_Iterator* i, const char** data, size_t* size);
 ADBUS_INLINE int adbus_iter_begindictentry(adbus_Iterator* i);
 ADBUS_INLINE int adbus_iter_enddictentry(adbus_Iterator* i);
 ADBUS_INLINE int adbus_iter_beginstruct(adbus_Iterator* i);
@@ -759,6 +818,7 @@ ADBUS_API void adbus_buf_reserve(adbus_Buffer* b, size_t sz);
 ADBUS_API char* adbus_buf_release(adbus_Buffer* b);
 ADBUS_API void adbus_buf_reset(adbus_Buffer* b);
 ADBUS_API void adbus_buf_remove(adbus_Buffer* b, size_t off, size_t num);
+ADBUS_API void adbus_buf_stats(const adbus_Buffer* b, size_t* moved, size_t* grows);
 ADBUS_API const char* adbus_buf_line(adbus_Buffer* b, size_t* sz);
 ADBUS_API char* adbus_buf_recvbuf(adbus_Buffer* b, size_t len);
 ADBUS_API void adbus_buf_recvd(adbus_Buffer* b, size_t len, adbus_ssize_t recvd);
@@ -790,6 +850,7 @@ ADBUS_API void adbus_buf_beginarray(adbus_Buffer* b, adbus_BufArray* a);
 ADBUS_API void adbus_buf_arrayentry(adbus_Buffer* b, adbus_BufArray* a);
 ADBUS_API void adbus_buf_checkarrayentry(adbus_Buffer* b, adbus_BufArray* a);
 ADBUS_API void adbus_buf_endarray(adbus_Buffer* b, adbus_BufArray* a);
+ADBUS_API void adbus_buf_fixedarray(adbus_Buffer* b, const char* data, size_t size);
 ADBUS_API void adbus_buf_begindictentry(adbus_Buffer* b);
 ADBUS_API void adbus_buf_enddictentry(adbus_Buffer* b);
 ADBUS_API void adbus_buf_beginstruct(adbus_Buffer* b);
@@ -815,6 +876,7 @@ ADBUS_API int adbus_flip_data(char* data, size_t size, const char* sig);
 ADBUS_API adbus_MsgFactory* adbus_msg_new(void);
 ADBUS_API void adbus_msg_free(adbus_MsgFactory* m);
 ADBUS_API void adbus_msg_reset(adbus_MsgFactory* m);
+ADBUS_API void adbus_msg_resetargs(adbus_MsgFactory* m);
 
 
 ADBUS_API int adbus_msg_build(adbus_MsgFactory* m, adbus_Message* msg);
@@ -908,6 +970,9 @@ ADBUS_INLINE const adbus_Buffer* adbus_msg_argbuffer_c(const adbus_MsgFactory* m
 /** Ends an array scope in the argument data (see adbus_buf_endarray()) */
 #define adbus_msg_endarray(m,a)     adbus_buf_endarray(adbus_msg_argbuffer(m), a)
 
+/** Appends a whole array of fixed size values to the argument data (see adbus_buf_fixedarray()) */
+#define adbus_msg_fixedarray(m,d,s) adbus_buf_fixedarray(adbus_msg_argbuffer(m), d, s)
+
 /** Begins a struct array scope in the argument data (see adbus_buf_beginstruct()) */
 #define adbus_msg_beginstruct(m)    adbus_buf_beginstruct(adbus_msg_argbuffer(m))
 
@@ -972,6 +1037,8 @@ struct adbus_Call
 
     adbus_Callback          release[2];
     void*                   ruser[2];
+
+    int                     timeout;
 };
 
 ADBUS_API adbus_Proxy* adbus_proxy_new(
@@ -1023,6 +1090,11 @@ ADBUS_API void adbus_call_send(
         adbus_Proxy*        proxy,
         adbus_Call*         call);
 
+ADBUS_API int adbus_call_block(
+        adbus_Proxy*        proxy,
+        adbus_Call*         call,
+        int                 timeoutms);
+
 
 ADBUS_API adbus_Signal* adbus_sig_new(
         adbus_Member*       mbr);
@@ -1050,6 +1122,9 @@ ADBUS_API void adbus_sig_emit(
 
 ADBUS_API adbus_Server* adbus_serv_new(adbus_Interface* bus);
 ADBUS_API void adbus_serv_free(adbus_Server* s);
+ADBUS_API void adbus_serv_setlock(adbus_Server* s, adbus_Callback lock, adbus_Callback unlock, adbus_Callback lockshared, adbus_Callback unlockshared, void* user);
+ADBUS_API void adbus_serv_setarena(adbus_Server* s, adbus_Bool enable);
+ADBUS_API void adbus_serv_arenastats(adbus_Server* s, size_t* messages, size_t* mallocs);
 
 ADBUS_API adbus_Remote* adbus_serv_connect(
         adbus_Server*           s,
@@ -1059,6 +1134,9 @@ ADBUS_API adbus_Remote* adbus_serv_connect(
 ADBUS_API void adbus_remote_disconnect(adbus_Remote* r);
 ADBUS_API int adbus_remote_dispatch(adbus_Remote* r, adbus_Message* m);
 ADBUS_API int adbus_remote_parse(adbus_Remote* r, adbus_Buffer* buf);
+ADBUS_API void adbus_remote_setqueue(adbus_Remote* r, adbus_SendMsgsCallback send, size_t threshold);
+ADBUS_API void adbus_remote_setqueuelock(adbus_Remote* r, adbus_Callback lock, adbus_Callback unlock, void* user);
+ADBUS_API int adbus_remote_flush(adbus_Remote* r);
 
 
 #ifdef __cplusplus
@@ -68,6 +68,25 @@ namespace adbus
         operator adbus_Buffer*() const {return b;}
     };
 
+    // Compile time information on how a type is marshalled. fixedSize is non
+    // zero for types whose in memory layout matches the native endian wire
+    // format, so that arrays of them can be copied in and out in one go.
+    // code is the signature character for the type.
+    template<class T> struct TypeInfo   { enum { fixedSize = 0, code = 0 }; };
+    template<> struct TypeInfo<uint8_t> { enum { fixedSize = 1, code = ADBUS_UINT8 }; };
+    template<> struct TypeInfo<int16_t> { enum { fixedSize = 2, code = ADBUS_INT16 }; };
+    template<> struct TypeInfo<uint16_t>{ enum { fixedSize = 2, code = ADBUS_UINT16 }; };
+    template<> struct TypeInfo<int32_t> { enum { fixedSize = 4, code = ADBUS_INT32 }; };
+    template<> struct TypeInfo<uint32_t>{ enum { fixedSize = 4, code = ADBUS_UINT32 }; };
+    template<> struct TypeInfo<int64_t> { enum { fixedSize = 8, code = ADBUS_INT64 }; };
+    template<> struct TypeInfo<uint64_t>{ enum { fixedSize = 8, code = ADBUS_UINT64 }; };
+    template<> struct TypeInfo<double>  { enum { fixedSize = 8, code = ADBUS_DOUBLE }; };
+    // bool is 4 bytes on the wire so uses the default
+
+    // Used to pick between the element by element and bulk copy versions of
+    // the array (de)marshalling
+    template<bool fixed> struct FixedTag {};
+
     inline void operator>>(bool v, Buffer& b)
     { adbus_buf_bool(b, v); }
     inline void operator>>(uint8_t v, Buffer& b)
@@ -92,7 +111,7 @@ namespace adbus
     { adbus_buf_string(b, s.c_str(), (int) s.size()); }
 
     template<class T>
-    inline void operator>>(const std::vector<T>& v, Buffer& b)
+    inline void AppendArray(const std::vector<T>& v, Buffer& b, FixedTag<false>)
     {
         adbus_BufArray a;
         adbus_buf_beginarray(b, &a);
@@ -105,6 +124,18 @@ namespace adbus
         adbus_buf_endarray(b, &a);
     }
 
+    template<class T>
+    inline void AppendArray(const std::vector<T>& v, Buffer& b, FixedTag<true>)
+    {
+        assert(adbus_buf_signext(b, NULL)[1] == TypeInfo<T>::code);
+        const char* data = v.empty() ? NULL : (const char*) &v[0];
+        adbus_buf_fixedarray(b, data, v.size() * sizeof(T));
+    }
+
+    template<class T>
+    inline void operator>>(const std::vector<T>& v, Buffer& b)
+    { AppendArray(v, b, FixedTag<TypeInfo<T>::fixedSize != 0>()); }
+
     template<class K, class V>
     inline void operator>>(const std::map<K,V>& map, Buffer& b)
     {
@@ -255,10 +286,9 @@ namespace adbus
     }
 
     template<class T>
-    inline int operator<<(std::vector<T>& v, Iterator& i)
+    inline int IterArray(std::vector<T>& v, Iterator& i, FixedTag<false>)
     {
         adbus_IterArray a;
-        i.Check(ADBUS_ARRAY_BEGIN);
         if (adbus_iter_beginarray(i, &a))
             return -1;
         while (adbus_iter_inarray(i, &a)) {
@@ -269,6 +299,26 @@ namespace adbus
         return adbus_iter_endarray(i, &a);
     }
 
+    template<class T>
+    inline int IterArray(std::vector<T>& v, Iterator& i, FixedTag<true>)
+    {
+        const char* data;
+        size_t size;
+        if (i.i.sig[1] != TypeInfo<T>::code)
+            throw ArgumentError();
+        if (adbus_iter_fixedarray(i, &data, &size))
+            return -1;
+        v.insert(v.end(), (const T*) data, (const T*) (data + size));
+        return 0;
+    }
+
+    template<class T>
+    inline int operator<<(std::vector<T>& v, Iterator& i)
+    {
+        i.Check(ADBUS_ARRAY_BEGIN);
+        return IterArray(v, i, FixedTag<TypeInfo<T>::fixedSize != 0>());
+    }
+
     template<class K, class V>
     inline int operator<<(std::map<K,V>& map, Iterator& i)
     {
@@ -734,6 +784,8 @@ namespace adbus
         adbus_Member* signal(const std::string& name) {return adbus_iface_signal(m_I, name.c_str(), (int) name.size());}
         adbus_Member* method(const std::string& name) {return adbus_iface_method(m_I, name.c_str(), (int) name.size());}
 
+        void freeze() {adbus_iface_freeze(m_I);}
+
         adbus_Interface* interface() {return m_I;}
         operator adbus_Interface*()  {return m_I;}
     private:
@@ -0,0 +1,211 @@
+/* vim: ts=4 sw=4 sts=4 et
+ *
+ * Copyright (c) 2009 James R. McKaskill
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * ----------------------------------------------------------------------------
+ */
+
+/* Stress test for adbus_conn_setthreaded. A number of producer threads send
+ * signals on the one connection while the main thread acts as the connection
+ * thread, running the flushes that the producers post via the proxy callback.
+ * Every message must arrive exactly once with a unique serial and with each
+ * producer's messages in the order they were sent.
+ */
+
+#include <adbus.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define THREADS 16
+#define MESSAGES 20000
+
+static adbus_Connection*    sConnection;
+static pthread_t            sConnectionThread;
+
+// Flushes posted by the producers, protected by sLock
+static pthread_mutex_t      sLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t       sCond = PTHREAD_COND_INITIALIZER;
+static adbus_Callback       sPosted;
+static void*                sPostedUser;
+
+// Only touched on the connection thread
+static uint32_t             sLast[THREADS];
+static unsigned char*       sSerials;
+static int                  sReceived;
+static int                  sErrors;
+
+void error(const char* what)
+{
+    printf("error: %s\n", what);
+    exit(-1);
+}
+
+static adbus_ssize_t SendMsg(void* u, adbus_Message* m)
+{
+    (void) u;
+    error("message sent directly");
+    return m->size;
+}
+
+static adbus_ssize_t SendMsgs(void* u, adbus_SharedMsg** msgs, size_t num)
+{
+    (void) u;
+    if (!pthread_equal(pthread_self(), sConnectionThread))
+        error("batch written off the connection thread");
+
+    size_t size = 0;
+    for (size_t i = 0; i < num; i++) {
+        // adbus_parse works in place, so it needs its own copy
+        char* data = (char*) malloc(msgs[i]->size);
+        memcpy(data, msgs[i]->data, msgs[i]->size);
+
+        adbus_Message m;
+        memset(&m, 0, sizeof(m));
+        if (adbus_parse(&m, data, msgs[i]->size))
+            error("parse");
+
+        const uint32_t* thread;
+        const uint32_t* index;
+        adbus_Iterator iter;
+        adbus_iter_args(&iter, &m);
+        if (adbus_iter_u32(&iter, &thread) || adbus_iter_u32(&iter, &index) || *thread >= THREADS)
+            error("arguments");
+
+        if (*index != sLast[*thread] + 1)
+            sErrors++;
+        sLast[*thread] = *index;
+
+        if (m.serial == 0 || m.serial > THREADS * MESSAGES || sSerials[m.serial]++)
+            sErrors++;
+
+        sReceived++;
+        size += msgs[i]->size;
+        free(data);
+    }
+
+    return size;
+}
+
+static adbus_Bool ShouldProxy(void* u)
+{
+    (void) u;
+    return !pthread_equal(pthread_self(), sConnectionThread);
+}
+
+static void Proxy(void* u, adbus_Callback cb, void* cbuser)
+{
+    (void) u;
+    if (!ShouldProxy(NULL)) {
+        cb(cbuser);
+        return;
+    }
+
+    // Only the push that finds the queue empty should post a flush, so there
+    // should never be two outstanding
+    pthread_mutex_lock(&sLock);
+    if (sPosted)
+        sErrors++;
+    sPosted = cb;
+    sPostedUser = cbuser;
+    pthread_cond_signal(&sCond);
+    pthread_mutex_unlock(&sLock);
+}
+
+static void* Producer(void* u)
+{
+    uint32_t thread = (uint32_t) (uintptr_t) u;
+    adbus_MsgFactory* f = adbus_msg_new();
+
+    for (uint32_t i = 1; i <= MESSAGES; i++) {
+        adbus_msg_reset(f);
+        adbus_msg_settype(f, ADBUS_MSG_SIGNAL);
+        adbus_msg_setserial(f, adbus_conn_serial(sConnection));
+        adbus_msg_setpath(f, "/", -1);
+        adbus_msg_setinterface(f, "nz.co.foobar.adbus.Test", -1);
+        adbus_msg_setmember(f, "Ping", -1);
+        adbus_msg_setsig(f, "uu", -1);
+        adbus_msg_u32(f, thread);
+        adbus_msg_u32(f, i);
+        if (adbus_msg_send(f, sConnection))
+            error("send");
+    }
+
+    adbus_msg_free(f);
+    return NULL;
+}
+
+int main()
+{
+    sConnectionThread = pthread_self();
+    sSerials = (unsigned char*) calloc(THREADS * MESSAGES + 1, 1);
+
+    adbus_ConnectionCallbacks cbs;
+    memset(&cbs, 0, sizeof(cbs));
+    cbs.send_message    = &SendMsg;
+    cbs.send_messages   = &SendMsgs;
+    cbs.should_proxy    = &ShouldProxy;
+    cbs.proxy           = &Proxy;
+
+    sConnection = adbus_conn_new(&cbs, NULL);
+    adbus_conn_setthreaded(sConnection, 1);
+
+    pthread_t threads[THREADS];
+    for (int i = 0; i < THREADS; i++) {
+        if (pthread_create(&threads[i], NULL, &Producer, (void*) (uintptr_t) i))
+            error("pthread_create");
+    }
+
+    while (sReceived < THREADS * MESSAGES) {
+        pthread_mutex_lock(&sLock);
+        while (!sPosted)
+            pthread_cond_wait(&sCond, &sLock);
+        adbus_Callback cb = sPosted;
+        void* cbuser = sPostedUser;
+        sPosted = NULL;
+        pthread_mutex_unlock(&sLock);
+
+        cb(cbuser);
+    }
+
+    for (int i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    // The last flush posted may have found its messages already written out
+    // by an earlier one, but it still needs to run to release its ref
+    if (sPosted)
+        sPosted(sPostedUser);
+
+    adbus_conn_setthreaded(sConnection, 0);
+    adbus_conn_free(sConnection);
+    free(sSerials);
+
+    if (sErrors) {
+        printf("%d errors\n", sErrors);
+        return -1;
+    }
+
+    printf("%d messages from %d threads\n", sReceived, THREADS);
+    return 0;
+}